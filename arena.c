@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/statfs.h>
+#include "arena.h"
+
+#define ALIGN_UP(n, a) (((n) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+/*
+ * Blocks of the arena will be BLOCK_SIZE bytes (within limits);
+ * nothing is mapped until the first allocation.
+ */
+void
+arena_init(struct arena *a, size_t block_size)
+{
+	memset(a, 0, sizeof(*a));
+
+	if (block_size < ARENA_MIN_BLOCK)
+		block_size = ARENA_MIN_BLOCK;
+	if (block_size > ARENA_MAX_BLOCK)
+		block_size = ARENA_MAX_BLOCK;
+
+	a->block_size = ALIGN_UP(block_size, 4096);
+}
+
+static struct arena_block *
+new_block(struct arena *a, size_t need)
+{
+	struct arena_block	*b = NULL;
+	size_t			size = a->block_size;
+	void			*p;
+
+	/* if the first guess was short, grow geometrically */
+	if (size < a->mapped)
+		size = (a->mapped < ARENA_MAX_BLOCK ? a->mapped : ARENA_MAX_BLOCK);
+
+	need = ALIGN_UP(need + sizeof(struct arena_block), 4096);
+	if (size < need)
+		size = need;
+
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	b = p;
+	b->next = a->head;
+	b->size = size;
+	b->used = sizeof(struct arena_block);
+
+	a->head = b;
+	a->mapped += size;
+	++a->nr_blocks;
+
+	return b;
+}
+
+/*
+ * SIZE bytes aligned to ALIGN (a power of two), not zeroed out
+ * unless they come from a new block.
+ */
+void *
+arena_alloc(struct arena *a, size_t size, size_t align)
+{
+	struct arena_block	*b = a->head;
+	size_t			off;
+
+	if (!b || (ALIGN_UP(b->used, align) + size) > b->size)
+	{
+		if (!(b = new_block(a, size + align)))
+			return NULL;
+	}
+
+	off = ALIGN_UP(b->used, align);
+	b->used = off + size;
+	a->allocated += size;
+
+	return ((char *)b + off);
+}
+
+/*
+ * A copy of the L bytes of S, NUL-terminated, with EXTRA
+ * more bytes of room after the NUL.
+ */
+char *
+arena_strndup(struct arena *a, const char *s, size_t l, size_t extra)
+{
+	char		*p;
+
+	if (!(p = arena_alloc(a, l + 1 + extra, 1)))
+		return NULL;
+
+	memcpy(p, s, l);
+	p[l] = 0;
+
+	return p;
+}
+
+/*
+ * Give back everything in the arena at once.
+ */
+void
+arena_release(struct arena *a)
+{
+	struct arena_block	*b, *next;
+
+	for (b = a->head; b; b = next)
+	{
+		next = b->next;
+		munmap(b, b->size);
+	}
+
+	a->head = NULL;
+	a->allocated = 0;
+	a->mapped = 0;
+	a->nr_blocks = 0;
+}
+
+/*
+ * How many files the scan of PATH might find: the number of inodes in
+ * use on its file system (an overestimate for anything but the root of
+ * it). Returns 0 if the file system does not say.
+ */
+uint64_t
+arena_estimate_files(const char *path)
+{
+	struct statfs	sf;
+
+	if (statfs(path, &sf) < 0 || sf.f_files == 0 || sf.f_ffree > sf.f_files)
+		return 0;
+
+	return (uint64_t)(sf.f_files - sf.f_ffree);
+}
@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump-pointer arenas.
+ *
+ * Memory is handed out from large blocks mapped with MAP_NORESERVE, so a
+ * block sized for the whole scan costs nothing until it is written to.
+ * Nothing is freed on its own: the arena is released as a whole, a block
+ * at a time, and a scan never needs more than a few blocks.
+ */
+
+#define ARENA_MIN_BLOCK	(1024 * 1024)
+#define ARENA_MAX_BLOCK	((size_t)1 << 36) /* 64 GiB of address space */
+
+struct arena_block
+{
+	struct arena_block	*next;
+	size_t			size;
+	size_t			used;
+};
+
+struct arena
+{
+	struct arena_block	*head;
+	size_t			block_size;
+	uint64_t		allocated; /* bytes handed out */
+	uint64_t		mapped;
+	int			nr_blocks;
+};
+
+void arena_init(struct arena *, size_t);
+void *arena_alloc(struct arena *, size_t, size_t);
+char *arena_strndup(struct arena *, const char *, size_t, size_t);
+void arena_release(struct arena *);
+uint64_t arena_estimate_files(const char *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined ARENA_H */
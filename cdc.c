@@ -0,0 +1,523 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cdc.h"
+#include "iolimit.h"
+
+/*
+ * The masks of normalised chunking for an average of 8 KiB: more bits
+ * (so cuts are less likely) before the average size, fewer after it.
+ */
+#define MASK_S		0x0003590703530000ull
+#define MASK_L		0x0000d90003530000ull
+
+#define CDC_NR_FILES	1024
+
+static uint64_t gear[256];
+
+/*
+ * The gear table only has to be random-looking and the
+ * same from run to run, so it comes from splitmix64.
+ */
+static void
+gear_init(void)
+{
+	uint64_t	x = 0x706f6c6c7578ull; /* "pollux" */
+	uint64_t	z;
+	int		i;
+
+	for (i = 0; i < 256; ++i)
+	{
+		z = (x += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/*
+ * Length of the chunk at the start of the N bytes at P. The caller
+ * makes sure N is at least CDC_MAX_SIZE unless the file ends sooner.
+ */
+static size_t
+cdc_cut(const unsigned char *p, size_t n)
+{
+	uint64_t	fp = 0;
+	size_t		i, normal = CDC_AVG_SIZE, limit = n;
+
+	if (n <= CDC_MIN_SIZE)
+		return n;
+
+	if (limit > CDC_MAX_SIZE)
+		limit = CDC_MAX_SIZE;
+	if (normal > limit)
+		normal = limit;
+
+	for (i = CDC_MIN_SIZE; i < normal; ++i)
+	{
+		fp = (fp << 1) + gear[p[i]];
+		if (!(fp & MASK_S))
+			return (i + 1);
+	}
+
+	for (; i < limit; ++i)
+	{
+		fp = (fp << 1) + gear[p[i]];
+		if (!(fp & MASK_L))
+			return (i + 1);
+	}
+
+	return limit;
+}
+
+static inline uint64_t
+pow2_floor(uint64_t n)
+{
+	uint64_t	p = 1;
+
+	while ((p << 1) <= n)
+		p <<= 1;
+
+	return p;
+}
+
+static inline uint64_t
+pair_hash(uint32_t a, uint32_t b)
+{
+	uint64_t	h = (((uint64_t)a << 32) | b);
+
+	h ^= (h >> 33);
+	h *= 0xff51afd7ed558ccdull;
+	h ^= (h >> 33);
+
+	return h;
+}
+
+/*
+ * Use at most MEM_LIMIT bytes for the chunk index and the table
+ * of file pairs (the list of files comes on top of that).
+ */
+struct cdc_index *
+cdc_open(const EVP_MD *md, size_t mem_limit)
+{
+	struct cdc_index	*ci = NULL;
+
+	if (!(ci = calloc(1, sizeof(*ci))))
+		return NULL;
+
+	ci->md = md;
+	ci->nr_chunks = pow2_floor(((mem_limit / 4) * 3) / sizeof(struct cdc_chunk));
+	ci->nr_pairs = pow2_floor((mem_limit / 4) / sizeof(struct cdc_pair));
+
+	if (!(ci->buf = malloc(CDC_BUF_SIZE)))
+		goto fail;
+
+	if (!(ci->chunks = calloc(ci->nr_chunks, sizeof(struct cdc_chunk))))
+		goto fail;
+
+	if (!(ci->pairs = calloc(ci->nr_pairs, sizeof(struct cdc_pair))))
+		goto fail;
+
+	gear_init();
+
+	return ci;
+
+	fail:
+	cdc_close(ci);
+	return NULL;
+}
+
+void
+cdc_close(struct cdc_index *ci)
+{
+	uint32_t	i;
+
+	if (!ci)
+		return;
+
+	for (i = 0; i < ci->nr_files; ++i)
+		free(ci->files[i].path);
+
+	free(ci->files);
+	free(ci->pairs);
+	free(ci->chunks);
+	free(ci->buf);
+	free(ci);
+}
+
+/*
+ * Remove the entry in slot I, moving up the entries after it that
+ * would otherwise no longer be found (linear probing).
+ */
+static void
+chunk_delete(struct cdc_index *ci, uint64_t i)
+{
+	uint64_t	mask = ci->nr_chunks - 1;
+	uint64_t	j = i, k;
+
+	ci->chunks[i].len = 0;
+	--ci->chunks_used;
+
+	for (;;)
+	{
+		j = ((j + 1) & mask);
+
+		if (!ci->chunks[j].len)
+			break;
+
+		k = (ci->chunks[j].h[0] & mask);
+
+		/* the entry is still reachable from its home slot K */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		ci->chunks[i] = ci->chunks[j];
+		ci->chunks[j].len = 0;
+		i = j;
+	}
+}
+
+/*
+ * Halve the rate at which chunks are sampled and drop
+ * the entries that are no longer in the sample.
+ */
+static void
+cdc_resample(struct cdc_index *ci)
+{
+	uint64_t	keep, i;
+
+	++ci->shift;
+	keep = ((1ull << ci->shift) - 1);
+
+	for (i = 0; i < ci->nr_chunks; ++i)
+	{
+		while (ci->chunks[i].len && (ci->chunks[i].h[1] & keep))
+			chunk_delete(ci, i);
+	}
+}
+
+static void
+pair_add(struct cdc_index *ci, uint32_t a, uint32_t b, uint64_t bytes)
+{
+	uint64_t	mask = ci->nr_pairs - 1;
+	uint64_t	i = (pair_hash(a, b) & mask);
+
+	while (ci->pairs[i].bytes)
+	{
+		if (ci->pairs[i].a == a && ci->pairs[i].b == b)
+		{
+			ci->pairs[i].bytes += bytes;
+			return;
+		}
+
+		i = ((i + 1) & mask);
+	}
+
+	if (ci->pairs_used >= ((ci->nr_pairs >> 2) * 3))
+	{
+		ci->stats.unpaired += bytes;
+		return;
+	}
+
+	ci->pairs[i].a = a;
+	ci->pairs[i].b = b;
+	ci->pairs[i].bytes = bytes;
+	++ci->pairs_used;
+}
+
+static int
+cdc_add_chunk(struct cdc_index *ci, uint32_t file, const unsigned char *p, size_t len)
+{
+	unsigned char		d[EVP_MAX_MD_SIZE];
+	struct cdc_chunk	*e = NULL;
+	uint64_t		h[2], mask = ci->nr_chunks - 1;
+	uint64_t		weight, i;
+
+	if (1 != EVP_Digest(p, len, d, NULL, ci->md, NULL))
+		return -1;
+
+	memcpy(h, d, sizeof(h));
+	++ci->stats.chunks;
+
+	if (h[1] & ((1ull << ci->shift) - 1))
+		return 0;
+
+	weight = ((uint64_t)len << ci->shift);
+
+	for (i = (h[0] & mask); ci->chunks[i].len; i = ((i + 1) & mask))
+	{
+		e = &ci->chunks[i];
+
+		if (e->h[0] != h[0] || e->h[1] != h[1])
+			continue;
+
+		ci->files[file].shared += weight;
+		ci->stats.shared += weight;
+
+		if (e->file != file)
+			pair_add(ci, e->file, file, weight);
+
+		return 0;
+	}
+
+	e = &ci->chunks[i];
+	e->h[0] = h[0];
+	e->h[1] = h[1];
+	e->file = file;
+	e->len = (uint32_t)len;
+
+	if (++ci->chunks_used > ((ci->nr_chunks >> 2) * 3))
+		cdc_resample(ci);
+
+	return 0;
+}
+
+/*
+ * Cut the file PATH into chunks and add them to the index.
+ */
+int
+cdc_add_file(struct cdc_index *ci, const char *path)
+{
+	struct cdc_file		*f = NULL;
+	size_t			have = 0, off = 0, len = 0;
+	ssize_t			n = 0;
+	uint32_t		id = 0;
+	int			fd = -1;
+	int			eof = 0;
+	int			_errno = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (ci->nr_files == ci->files_size)
+	{
+		ci->files_size = (ci->files_size ? (ci->files_size << 1) : CDC_NR_FILES);
+
+		if (!(f = realloc(ci->files, ci->files_size * sizeof(struct cdc_file))))
+			goto fail;
+
+		ci->files = f;
+	}
+
+	id = ci->nr_files;
+	f = &ci->files[id];
+	memset(f, 0, sizeof(*f));
+
+	if (!(f->path = strdup(path)))
+		goto fail;
+
+	++ci->nr_files;
+	++ci->stats.files;
+
+	while (!eof)
+	{
+		while (!eof && have < CDC_BUF_SIZE)
+		{
+			if ((n = plx_read(fd, ci->buf + have, CDC_BUF_SIZE - have)) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				goto fail;
+			}
+
+			if (n == 0)
+				eof = 1;
+
+			have += n;
+		}
+
+		for (off = 0; (have - off) >= CDC_MAX_SIZE || (eof && off < have); off += len)
+		{
+			len = cdc_cut(ci->buf + off, have - off);
+
+			if (cdc_add_chunk(ci, id, ci->buf + off, len) < 0)
+				goto fail;
+		}
+
+		ci->files[id].size += off;
+		ci->stats.bytes += off;
+
+		memmove(ci->buf, ci->buf + off, have - off);
+		have -= off;
+	}
+
+	close(fd);
+	return 0;
+
+	fail:
+	_errno = errno;
+	close(fd);
+	errno = _errno;
+	return -1;
+}
+
+static char *
+human(uint64_t n, char *buf, size_t size)
+{
+	static const char	*units[] = { "bytes", "KB", "MB", "GB", "TB", "PB" };
+	double			d = (double)n;
+	int			u = 0;
+
+	while (d > 999.0 && u < 5)
+	{
+		d /= 1000.0;
+		++u;
+	}
+
+	snprintf(buf, size, "%.2lf %s", d, units[u]);
+	return buf;
+}
+
+static int
+pair_cmp(const void *a, const void *b)
+{
+	const struct cdc_pair	*p1 = a;
+	const struct cdc_pair	*p2 = b;
+
+	return (p1->bytes < p2->bytes ? 1 : (p1->bytes > p2->bytes ? -1 : 0));
+}
+
+
+static int
+file_shared_cmp(const void *a, const void *b)
+{
+	const struct cdc_file	*f1 = a;
+	const struct cdc_file	*f2 = b;
+
+	return (f1->shared < f2->shared ? 1 : (f1->shared > f2->shared ? -1 : 0));
+}
+
+static size_t
+dir_len(const char *path)
+{
+	const char	*p = strrchr(path, '/');
+
+	return (p ? (size_t)(p - path) : 0);
+}
+
+/*
+ * By directory, then by name within it, so that the files of a
+ * directory are not split up by those of its subdirectories
+ * ("a/b/x", "a/b/zz", then "a/b/y/z").
+ */
+static int
+file_dir_cmp(const void *a, const void *b)
+{
+	const struct cdc_file	*f1 = a;
+	const struct cdc_file	*f2 = b;
+	size_t			l1 = dir_len(f1->path);
+	size_t			l2 = dir_len(f2->path);
+	int			r;
+
+	if ((r = memcmp(f1->path, f2->path, (l1 < l2 ? l1 : l2))))
+		return r;
+
+	if (l1 != l2)
+		return (l1 < l2 ? -1 : 1);
+
+	return strcmp(f1->path + l1, f2->path + l2);
+}
+
+/*
+ * Print the totals and the TOP pairs of files and directories
+ * with the most bytes in chunks found elsewhere.
+ */
+void
+cdc_report(struct cdc_index *ci, FILE *fp, int top)
+{
+	struct cdc_pair		*pairs = NULL;
+	struct cdc_file		*files = NULL, *dirs = NULL;
+	uint64_t		i, n;
+	uint32_t		j, k, nr_dirs = 0;
+	char			b1[32], b2[32];
+
+	fprintf(fp, "\nChunk-level duplication (FastCDC, %d/%d/%d KiB chunks)\n\n",
+		CDC_MIN_SIZE >> 10, CDC_AVG_SIZE >> 10, CDC_MAX_SIZE >> 10);
+
+	fprintf(fp, "%22s: %lu (%s)\n", "Files chunked",
+		(unsigned long)ci->stats.files,
+		human(ci->stats.bytes, b1, sizeof(b1)));
+	fprintf(fp, "%22s: %lu\n", "Chunks", (unsigned long)ci->stats.chunks);
+	fprintf(fp, "%22s: %s (%.2lf%%)%s\n", "Shared",
+		human(ci->stats.shared, b1, sizeof(b1)),
+		(ci->stats.bytes ? ((double)ci->stats.shared / (double)ci->stats.bytes) * 100 : 0.0),
+		(ci->shift ? " (estimated)" : ""));
+
+	if (ci->shift)
+		fprintf(fp, "%22s: 1 in %lu chunks\n", "Sampled", (unsigned long)(1ul << ci->shift));
+
+	if (ci->stats.unpaired)
+		fprintf(fp, "%22s: %s\n", "Not attributed", human(ci->stats.unpaired, b1, sizeof(b1)));
+
+	if (!(pairs = malloc(ci->pairs_used * sizeof(struct cdc_pair) + 1)))
+		goto out;
+
+	for (i = 0, n = 0; i < ci->nr_pairs; ++i)
+	{
+		if (ci->pairs[i].bytes)
+			pairs[n++] = ci->pairs[i];
+	}
+
+	qsort(pairs, n, sizeof(struct cdc_pair), pair_cmp);
+
+	if (n)
+		fprintf(fp, "\nFile pairs sharing the most data:\n\n");
+
+	for (i = 0; i < n && i < (uint64_t)top; ++i)
+	{
+		fprintf(fp, "%14s  %s\n%14s  %s\n",
+			human(pairs[i].bytes, b1, sizeof(b1)),
+			ci->files[pairs[i].b].path,
+			"in", ci->files[pairs[i].a].path);
+	}
+
+	/*
+	 * Sum the files up by directory: sorted by directory,
+	 * the files of each one come one after the other.
+	 */
+	if (!(files = malloc(ci->nr_files * sizeof(struct cdc_file) + 1))
+		|| !(dirs = calloc(ci->nr_files + 1, sizeof(struct cdc_file))))
+		goto out;
+
+	memcpy(files, ci->files, ci->nr_files * sizeof(struct cdc_file));
+	qsort(files, ci->nr_files, sizeof(struct cdc_file), file_dir_cmp);
+
+	for (j = 0; j < ci->nr_files; j = k)
+	{
+		dirs[nr_dirs].path = files[j].path;
+
+		for (k = j; k < ci->nr_files && dir_len(files[k].path) == dir_len(files[j].path)
+			&& !strncmp(files[k].path, files[j].path, dir_len(files[j].path)); ++k)
+		{
+			dirs[nr_dirs].size += files[k].size;
+			dirs[nr_dirs].shared += files[k].shared;
+		}
+
+		if (dirs[nr_dirs].shared)
+			++nr_dirs;
+	}
+
+	qsort(dirs, nr_dirs, sizeof(struct cdc_file), file_shared_cmp);
+
+	if (nr_dirs)
+		fprintf(fp, "\nDirectories with the most data found elsewhere:\n\n");
+
+	for (j = 0; j < nr_dirs && j < (uint32_t)top; ++j)
+	{
+		fprintf(fp, "%14s of %-14s %.*s\n",
+			human(dirs[j].shared, b1, sizeof(b1)),
+			human(dirs[j].size, b2, sizeof(b2)),
+			(int)dir_len(dirs[j].path), dirs[j].path);
+	}
+
+	out:
+	free(dirs);
+	free(files);
+	free(pairs);
+}
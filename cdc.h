@@ -0,0 +1,91 @@
+#ifndef CDC_H
+#define CDC_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <openssl/evp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Chunk-level duplication.
+ *
+ * Files are cut into chunks at boundaries chosen by their contents, with
+ * FastCDC (a gear-hash rolling fingerprint and normalised chunking), so a
+ * run of data shared by two files yields the same chunks wherever it sits
+ * in either of them. Each chunk is hashed and looked up in an index of the
+ * chunks seen so far; a chunk already there is counted as shared with the
+ * file that had it first, for that pair of files and for the directory.
+ *
+ * Files are read in CDC_BUF_SIZE pieces and the index has a fixed size,
+ * so any amount of data can be analysed. Once the index fills up, only
+ * chunks whose digest has its low SHIFT bits clear are kept and looked
+ * up, SHIFT growing by one each time; each chunk counted is then weighed
+ * by 2^SHIFT, and the figures become estimates.
+ */
+
+#define CDC_MIN_SIZE	(2 * 1024)
+#define CDC_AVG_SIZE	(8 * 1024)
+#define CDC_MAX_SIZE	(64 * 1024)
+#define CDC_BUF_SIZE	(1024 * 1024)
+
+struct cdc_chunk
+{
+	uint64_t	h[2];	/* first 128 bits of the digest */
+	uint32_t	file;	/* the first file that had it */
+	uint32_t	len;	/* 0 if the slot is free */
+};
+
+struct cdc_pair
+{
+	uint32_t	a;	/* the file the chunks were first seen in */
+	uint32_t	b;
+	uint64_t	bytes;	/* 0 if the slot is free */
+};
+
+struct cdc_file
+{
+	char		*path;
+	uint64_t	size;
+	uint64_t	shared;
+};
+
+struct cdc_stats
+{
+	uint64_t	files;
+	uint64_t	bytes;
+	uint64_t	chunks;
+	uint64_t	shared;
+	uint64_t	unpaired; /* shared, but the pair table was full */
+};
+
+struct cdc_index
+{
+	const EVP_MD		*md;
+	unsigned char		*buf;
+	struct cdc_chunk	*chunks;
+	uint64_t		nr_chunks;
+	uint64_t		chunks_used;
+	struct cdc_pair		*pairs;
+	uint64_t		nr_pairs;
+	uint64_t		pairs_used;
+	struct cdc_file		*files;
+	uint32_t		nr_files;
+	uint32_t		files_size;
+	int			shift;
+	struct cdc_stats	stats;
+};
+
+struct cdc_index *cdc_open(const EVP_MD *, size_t);
+void cdc_close(struct cdc_index *);
+int cdc_add_file(struct cdc_index *, const char *);
+void cdc_report(struct cdc_index *, FILE *, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined CDC_H */
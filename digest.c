@@ -0,0 +1,524 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <linux/if_alg.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+#endif
+#include "digest.h"
+#include "iolimit.h"
+
+const struct plx_digest plx_digests[NR_PLX_DIGESTS] =
+{
+	{ "md5", "MD5", 16, 0, "md5" },
+	{ "sha1", "SHA1", 20, 0, "sha1" },
+	{ "sha256", "SHA256", 32, 128, "sha256" },
+	{ "sha512-256", "SHA512/256", 32, 128, NULL },
+	{ "sha3-256", "SHA3-256", 32, 128, "sha3-256" },
+	{ "blake2s256", "BLAKE2s-256", 32, 128, NULL },
+	{ "sha512", "SHA512", 64, 256, "sha512" },
+	{ "sha3-512", "SHA3-512", 64, 256, "sha3-512" },
+	{ "blake2b512", "BLAKE2b-512", 64, 256, "blake2b-512" }
+};
+
+/*
+ * Without calibration, the digests are tried in these orders (roughly
+ * fastest first, as measured with OpenSSL on typical machines of each
+ * kind) and the first one that is strong enough and short enough wins.
+ */
+static const char *prefer_sha[NR_PLX_DIGESTS] =
+{
+	"sha256", "sha1", "blake2b512", "sha512-256", "sha512", "md5", "blake2s256", "sha3-256", "sha3-512"
+};
+
+static const char *prefer_64bit[NR_PLX_DIGESTS] =
+{
+	"blake2b512", "sha512-256", "sha512", "sha1", "md5", "blake2s256", "sha256", "sha3-256", "sha3-512"
+};
+
+static const char *prefer_32bit[NR_PLX_DIGESTS] =
+{
+	"blake2s256", "sha1", "md5", "sha256", "blake2b512", "sha512-256", "sha512", "sha3-256", "sha3-512"
+};
+
+/* each candidate is timed for this long when calibrating */
+#define CALIBRATE_NSEC	(20 * 1000000L)
+#define CALIBRATE_BUF	65536
+
+unsigned int
+plx_cpu_features(void)
+{
+	unsigned int	features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int	eax, ebx, ecx, edx;
+#endif
+
+	if (sizeof(void *) >= 8)
+		features |= PLX_CPU_64BIT;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+	{
+		if (ebx & (1u << 29))
+			features |= PLX_CPU_SHA;
+		if (ebx & (1u << 5))
+			features |= PLX_CPU_AVX2;
+		if (ebx & (1u << 16))
+			features |= PLX_CPU_AVX512;
+	}
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_SHA2)
+		features |= PLX_CPU_SHA;
+#endif
+
+	return features;
+}
+
+/*
+ * Find a digest by its name or its label (in any case).
+ */
+int
+plx_digest_index(const char *name)
+{
+	int		i;
+
+	for (i = 0; i < NR_PLX_DIGESTS; ++i)
+	{
+		if (!strcasecmp(name, plx_digests[i].name) || !strcasecmp(name, plx_digests[i].label))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * The implementation of digest IDX, or NULL if this
+ * build of OpenSSL does not have it.
+ */
+const EVP_MD *
+plx_digest_md(int idx)
+{
+	if (idx < 0 || idx >= NR_PLX_DIGESTS)
+		return NULL;
+
+	return EVP_get_digestbyname(plx_digests[idx].name);
+}
+
+/*
+ * Bytes per second MD hashes BUF at, in blocks of LEN bytes.
+ */
+static double
+measure(const EVP_MD *md, unsigned char *buf, size_t len)
+{
+	EVP_MD_CTX		*ctx = NULL;
+	unsigned char		out[EVP_MAX_MD_SIZE];
+	struct timespec		t0, t1;
+	uint64_t		bytes = 0;
+	long			ns = 0;
+
+	if (!(ctx = EVP_MD_CTX_create()))
+		return 0.0;
+
+	/* warm up */
+	if (1 != EVP_DigestInit_ex(ctx, md, NULL)
+		|| 1 != EVP_DigestUpdate(ctx, buf, len)
+		|| 1 != EVP_DigestFinal_ex(ctx, out, NULL))
+		goto fail;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	do
+	{
+		if (1 != EVP_DigestInit_ex(ctx, md, NULL)
+			|| 1 != EVP_DigestUpdate(ctx, buf, len)
+			|| 1 != EVP_DigestFinal_ex(ctx, out, NULL))
+			goto fail;
+
+		bytes += len;
+
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = ((t1.tv_sec - t0.tv_sec) * 1000000000L) + (t1.tv_nsec - t0.tv_nsec);
+	} while (ns < CALIBRATE_NSEC);
+
+	EVP_MD_CTX_destroy(ctx);
+
+	return ((double)bytes * 1e9) / (double)ns;
+
+	fail:
+	EVP_MD_CTX_destroy(ctx);
+	return 0.0;
+}
+
+/*
+ * Pick the digest to use: the fastest of those with at least MIN_STRENGTH
+ * bits of collision resistance and no more than MAX_SIZE bytes of output.
+ * With CALIBRATE set, each candidate is timed (for a short while) and the
+ * fastest is taken; otherwise the choice is made from the CPU features.
+ * Returns the index of the digest, or -1 if none will do.
+ */
+int
+plx_digest_select(int min_strength, unsigned int max_size, int calibrate)
+{
+	const char		**prefer = NULL;
+	unsigned int		features = plx_cpu_features();
+	unsigned char		*buf = NULL;
+	double			rate = 0.0, best_rate = 0.0;
+	int			best = -1;
+	int			i, idx;
+
+	if (features & PLX_CPU_SHA)
+		prefer = prefer_sha;
+	else
+	if (features & PLX_CPU_64BIT)
+		prefer = prefer_64bit;
+	else
+		prefer = prefer_32bit;
+
+	if (calibrate && !(buf = malloc(CALIBRATE_BUF)))
+		calibrate = 0;
+
+	if (buf)
+	{
+		for (i = 0; i < CALIBRATE_BUF; ++i)
+			buf[i] = (unsigned char)((i * 2654435761u) >> 13);
+	}
+
+	for (i = 0; i < NR_PLX_DIGESTS; ++i)
+	{
+		if ((idx = plx_digest_index(prefer[i])) < 0)
+			continue;
+
+		if (plx_digests[idx].strength < min_strength || plx_digests[idx].size > max_size)
+			continue;
+
+		if (!plx_digest_md(idx))
+			continue;
+
+		if (!calibrate)
+		{
+			best = idx;
+			break;
+		}
+
+		if ((rate = measure(plx_digest_md(idx), buf, CALIBRATE_BUF)) > best_rate)
+		{
+			best_rate = rate;
+			best = idx;
+		}
+	}
+
+	free(buf);
+
+	return best;
+}
+
+/*
+ * Finding a digest among NR digests of LEN bytes stored back to back:
+ * each digest is compared whole, 16 or 32 bytes per instruction, and
+ * four of them are in flight at once, so a long scan runs at the speed
+ * of the memory rather than that of one compare after another.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+
+#define FIND_UNROLL	4
+
+__attribute__((target("avx2")))
+static long
+find_avx2(const unsigned char *d, size_t nr, size_t len, const unsigned char *key)
+{
+	__m256i		k[EVP_MAX_MD_SIZE >> 5];
+	unsigned int	m[FIND_UNROLL];
+	size_t		w = (len >> 5), i, j, u;
+
+	for (j = 0; j < w; ++j)
+		k[j] = _mm256_loadu_si256((const __m256i *)(key + (j << 5)));
+
+	for (i = 0; i < nr; i += FIND_UNROLL)
+	{
+		for (u = 0; u < FIND_UNROLL; ++u)
+		{
+			m[u] = 0xffffffffu;
+
+			for (j = 0; j < w && (i + u) < nr; ++j)
+				m[u] &= (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+					_mm256_loadu_si256((const __m256i *)(d + ((i + u) * len) + (j << 5))), k[j]));
+		}
+
+		for (u = 0; u < FIND_UNROLL && (i + u) < nr; ++u)
+		{
+			if (m[u] == 0xffffffffu)
+				return (long)(i + u);
+		}
+	}
+
+	return -1;
+}
+
+__attribute__((target("sse2")))
+static long
+find_sse2(const unsigned char *d, size_t nr, size_t len, const unsigned char *key)
+{
+	__m128i		k[EVP_MAX_MD_SIZE >> 4];
+	unsigned int	m[FIND_UNROLL];
+	size_t		w = (len >> 4), i, j, u;
+
+	for (j = 0; j < w; ++j)
+		k[j] = _mm_loadu_si128((const __m128i *)(key + (j << 4)));
+
+	for (i = 0; i < nr; i += FIND_UNROLL)
+	{
+		for (u = 0; u < FIND_UNROLL; ++u)
+		{
+			m[u] = 0xffff;
+
+			for (j = 0; j < w && (i + u) < nr; ++j)
+				m[u] &= (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+					_mm_loadu_si128((const __m128i *)(d + ((i + u) * len) + (j << 4))), k[j]));
+		}
+
+		for (u = 0; u < FIND_UNROLL && (i + u) < nr; ++u)
+		{
+			if (m[u] == 0xffff)
+				return (long)(i + u);
+		}
+	}
+
+	return -1;
+}
+
+#endif
+
+/*
+ * The index of the first of the NR digests of LEN bytes at DIGESTS
+ * that is the same as KEY, or -1 if none of them is.
+ */
+long
+plx_digest_find(const unsigned char *digests, size_t nr, size_t len, const unsigned char *key)
+{
+	size_t		i;
+#if defined(__x86_64__) || defined(__i386__)
+	static int	have_avx2 = -1;
+
+	if (have_avx2 < 0)
+	{
+		__builtin_cpu_init();
+		have_avx2 = __builtin_cpu_supports("avx2");
+	}
+
+	if (len <= EVP_MAX_MD_SIZE)
+	{
+		if (have_avx2 && !(len & 0x1f))
+			return find_avx2(digests, nr, len, key);
+
+		if (__builtin_cpu_supports("sse2") && !(len & 0xf))
+			return find_sse2(digests, nr, len, key);
+	}
+#endif
+
+	for (i = 0; i < nr; ++i)
+	{
+		if (!memcmp(digests + (i * len), key, len))
+			return (long)i;
+	}
+
+	return -1;
+}
+
+#ifdef __linux__
+
+#ifndef SOL_ALG
+# define SOL_ALG 279
+#endif
+
+#define AFALG_PIPE_SIZE (1024 * 1024)
+
+/*
+ * Bind a socket to the kernel's implementation of digest IDX.
+ * Returns -1 (with errno set) if the kernel does not have it.
+ */
+int
+plx_afalg_open(struct plx_afalg *a, int idx)
+{
+	struct sockaddr_alg	sa;
+	int			sz;
+
+	a->tfm = a->op = a->pipe[0] = a->pipe[1] = -1;
+
+	if (idx < 0 || idx >= NR_PLX_DIGESTS || !plx_digests[idx].kname)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	strcpy((char *)sa.salg_type, "hash");
+	strncpy((char *)sa.salg_name, plx_digests[idx].kname, sizeof(sa.salg_name) - 1);
+
+	if ((a->tfm = socket(AF_ALG, SOCK_SEQPACKET|SOCK_CLOEXEC, 0)) < 0)
+		goto fail;
+
+	if (bind(a->tfm, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		goto fail;
+
+	if ((a->op = accept4(a->tfm, NULL, NULL, SOCK_CLOEXEC)) < 0)
+		goto fail;
+
+	if (pipe2(a->pipe, O_CLOEXEC) < 0)
+		goto fail;
+
+	/* a bigger pipe means fewer trips through splice() */
+	if ((sz = fcntl(a->pipe[1], F_SETPIPE_SZ, AFALG_PIPE_SIZE)) < 0)
+		sz = fcntl(a->pipe[1], F_GETPIPE_SZ);
+
+	a->chunk = (sz > 0 ? (size_t)sz : 65536);
+	a->size = plx_digests[idx].size;
+
+	return 0;
+
+	fail:
+	plx_afalg_close(a);
+	return -1;
+}
+
+void
+plx_afalg_close(struct plx_afalg *a)
+{
+	int		_errno = errno;
+
+	if (a->op != -1)
+		close(a->op);
+	if (a->tfm != -1)
+		close(a->tfm);
+	if (a->pipe[0] != -1)
+		close(a->pipe[0]);
+	if (a->pipe[1] != -1)
+		close(a->pipe[1]);
+
+	a->tfm = a->op = a->pipe[0] = a->pipe[1] = -1;
+	errno = _errno;
+}
+
+/*
+ * After a failure part way through a file, the operation socket holds a
+ * partial digest and the pipe may hold data: start again with new ones.
+ */
+static int
+afalg_reset(struct plx_afalg *a)
+{
+	int		_errno = errno;
+
+	close(a->op);
+	close(a->pipe[0]);
+	close(a->pipe[1]);
+	a->op = a->pipe[0] = a->pipe[1] = -1;
+
+	if ((a->op = accept4(a->tfm, NULL, NULL, SOCK_CLOEXEC)) < 0
+		|| pipe2(a->pipe, O_CLOEXEC) < 0)
+		return -1;
+
+	if (fcntl(a->pipe[1], F_SETPIPE_SZ, (int)a->chunk) < 0)
+		a->chunk = 65536;
+
+	errno = _errno;
+	return 0;
+}
+
+/*
+ * Put the digest of the SIZE bytes of the file open on FD into OUT. The
+ * file offset of FD is left alone, so a caller can fall back to reading
+ * the file itself if this fails.
+ */
+int
+plx_afalg_digest(struct plx_afalg *a, int fd, off_t size, unsigned char *out)
+{
+	off_t		off = 0, done = 0;
+	ssize_t		n, m;
+	size_t		chunk;
+	int64_t		t0 = 0;
+
+	while (off < size)
+	{
+		chunk = ((size - off) < (off_t)a->chunk ? (size_t)(size - off) : a->chunk);
+
+		if (plx_io.active)
+		{
+			plx_io_wait(chunk);
+			t0 = plx_io_now();
+		}
+
+		/* n == 0: the file is shorter than it was */
+		if ((n = splice(fd, &off, a->pipe[1], NULL, chunk, SPLICE_F_MOVE)) <= 0)
+			goto fail;
+
+		if (plx_io.active)
+			plx_io_done(plx_io_now() - t0);
+
+		/*
+		 * Only the splice that ends the file goes without MORE, as
+		 * that is what finishes the hash; if the socket takes less
+		 * than it was given, the rest is another splice, judged
+		 * again by where it ends.
+		 */
+		while (n > 0)
+		{
+			if ((m = splice(a->pipe[0], NULL, a->op, NULL, n,
+					SPLICE_F_MOVE | ((done + n) < size ? SPLICE_F_MORE : 0))) <= 0)
+				goto fail;
+
+			done += m;
+			n -= m;
+		}
+	}
+
+	if (read(a->op, out, a->size) != (ssize_t)a->size)
+		goto fail;
+
+	return 0;
+
+	fail:
+	if (errno == 0)
+		errno = EIO;
+
+	if (afalg_reset(a) < 0)
+		plx_afalg_close(a);
+
+	return -1;
+}
+
+#else
+
+int
+plx_afalg_open(struct plx_afalg *a, int idx)
+{
+	a->tfm = a->op = a->pipe[0] = a->pipe[1] = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+void
+plx_afalg_close(struct plx_afalg *a)
+{
+}
+
+int
+plx_afalg_digest(struct plx_afalg *a, int fd, off_t size, unsigned char *out)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,77 @@
+#ifndef DIGEST_H
+#define DIGEST_H 1
+
+#include <sys/types.h>
+#include <openssl/evp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The digests the front-ends can use, and the choice of one at startup.
+ *
+ * Which digest is fastest depends on the machine: with SHA extensions
+ * (x86 SHA-NI, ARMv8 SHA2), SHA-256 is hard to beat; without them, the
+ * 64-bit digests (BLAKE2b, SHA-512 and its truncation SHA-512/256) are
+ * much faster on 64-bit CPUs, and BLAKE2s on 32-bit ones. plx_digest_select()
+ * picks from the digests that are strong enough, by the CPU features or,
+ * optionally, by timing each of them.
+ */
+
+struct plx_digest
+{
+	const char	*name;		/* for EVP_get_digestbyname() */
+	const char	*label;		/* as shown to the user */
+	unsigned int	size;		/* in bytes */
+	int		strength;	/* collision resistance in bits; 0 if broken */
+	const char	*kname;		/* for AF_ALG; NULL if the kernel has none */
+};
+
+#define NR_PLX_DIGESTS		9
+#define PLX_DIGEST_STRENGTH	128 /* default minimum strength */
+
+extern const struct plx_digest plx_digests[NR_PLX_DIGESTS];
+
+/* CPU features that matter for the choice */
+#define PLX_CPU_SHA	0x1 /* SHA-256 instructions */
+#define PLX_CPU_AVX2	0x2
+#define PLX_CPU_AVX512	0x4
+#define PLX_CPU_64BIT	0x8
+
+unsigned int plx_cpu_features(void);
+int plx_digest_index(const char *);
+const EVP_MD *plx_digest_md(int);
+int plx_digest_select(int, unsigned int, int);
+long plx_digest_find(const unsigned char *, size_t, size_t, const unsigned char *);
+
+/*
+ * The digests are as good as random, so where one is the key of a
+ * hash table, its first bytes are used as the hash as they are.
+ */
+
+/*
+ * Hashing by the kernel, through an AF_ALG "hash" socket. The pages of
+ * the file are splice()d into the socket through a pipe, so the data is
+ * never copied into user space; only the digest is read back.
+ */
+struct plx_afalg
+{
+	int		tfm;	/* socket bound to the algorithm */
+	int		op;	/* operation socket, reused from file to file */
+	int		pipe[2];
+	size_t		chunk;	/* what the pipe can hold */
+	unsigned int	size;	/* of the digest */
+};
+
+#define PLX_AFALG_INIT { -1, -1, { -1, -1 }, 0, 0 }
+
+int plx_afalg_open(struct plx_afalg *, int);
+void plx_afalg_close(struct plx_afalg *);
+int plx_afalg_digest(struct plx_afalg *, int, off_t, unsigned char *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined DIGEST_H */
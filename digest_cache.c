@@ -0,0 +1,681 @@
+#include <ctype.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include "digest_cache.h"
+
+#define DCACHE_HDR_SIZE sizeof(struct dcache_header)
+#define DCACHE_FILE_SIZE(n) (DCACHE_HDR_SIZE + ((n) * sizeof(struct dcache_entry)))
+
+_Static_assert(sizeof(struct dcache_header) == sizeof(struct dcache_entry), "dcache header and entry sizes differ");
+_Static_assert(sizeof(struct dcache_entry) == 128, "dcache entry is not 128 bytes");
+
+#define ts_to_ns(ts) (((int64_t)(ts).tv_sec * 1000000000) + (ts).tv_nsec)
+
+/*
+ * Length of the digests of ALGO (an OpenSSL NID), or 0 if
+ * it is not known; a stored digest of any other length is
+ * not to be trusted.
+ */
+static unsigned int
+algo_size(int algo)
+{
+	const EVP_MD	*md = EVP_get_digestbynid(algo);
+
+	return (md ? (unsigned int)EVP_MD_size(md) : 0);
+}
+
+/*
+ * FNV-1a over everything in the entry but the check field
+ * itself. Zero is kept to mean "no entry".
+ */
+static uint32_t
+entry_check(const struct dcache_entry *e)
+{
+	const unsigned char	*p = (const unsigned char *)e;
+	uint32_t		h = 2166136261u;
+	size_t			i;
+
+	for (i = 0; i < sizeof(*e); ++i)
+	{
+		if (i >= offsetof(struct dcache_entry, check)
+			&& i < (offsetof(struct dcache_entry, check) + sizeof(e->check)))
+			continue;
+
+		h ^= p[i];
+		h *= 16777619u;
+	}
+
+	return (h ? h : 1);
+}
+
+static inline int
+entry_empty(const struct dcache_entry *e)
+{
+	return (e->check == 0 && e->dev == 0 && e->ino == 0 && e->algo == 0);
+}
+
+static inline int
+entry_valid(const struct dcache_entry *e)
+{
+	return (e->check != 0 && e->check == entry_check(e));
+}
+
+static inline int
+entry_current(const struct dcache *dc, const struct dcache_entry *e)
+{
+	return ((uint32_t)(dc->hdr->generation - e->generation) <= DCACHE_MAX_AGE);
+}
+
+static inline uint64_t
+slot_hash(uint64_t dev, uint64_t ino, uint32_t algo)
+{
+	uint64_t	h = (ino ^ (dev << 32) ^ (dev >> 32) ^ ((uint64_t)algo << 48));
+
+	h ^= (h >> 33);
+	h *= 0xff51afd7ed558ccdull;
+	h ^= (h >> 33);
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= (h >> 33);
+
+	return h;
+}
+
+/*
+ * Find the slot for (DEV,INO,ALGO). Returns the entry if present,
+ * otherwise NULL and the first slot it could be stored in in *FREE.
+ */
+static struct dcache_entry *
+find_slot(struct dcache *dc, uint64_t dev, uint64_t ino, uint32_t algo, struct dcache_entry **free_slot)
+{
+	struct dcache_entry	*e = NULL;
+	uint64_t		mask = (dc->hdr->nr_slots - 1);
+	uint64_t		idx = (slot_hash(dev, ino, algo) & mask);
+	uint64_t		i;
+
+	if (free_slot)
+		*free_slot = NULL;
+
+	for (i = 0; i < dc->hdr->nr_slots; ++i, idx = ((idx + 1) & mask))
+	{
+		e = &dc->slots[idx];
+
+		if (entry_empty(e))
+		{
+			if (free_slot && !*free_slot)
+				*free_slot = e;
+
+			return NULL;
+		}
+
+		/*
+		 * A slot whose checksum does not match was being written when
+		 * we last crashed: it is still part of a probe chain, but can
+		 * be reused.
+		 */
+		if (!entry_valid(e))
+		{
+			if (free_slot && !*free_slot)
+				*free_slot = e;
+
+			continue;
+		}
+
+		if (e->dev == dev && e->ino == ino && e->algo == algo)
+			return e;
+	}
+
+	return NULL;
+}
+
+static int
+map_file(struct dcache *dc, int fd, size_t size)
+{
+	void	*map = NULL;
+
+	if ((map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		return -1;
+
+	dc->map_size = size;
+	dc->hdr = (struct dcache_header *)map;
+	dc->slots = (struct dcache_entry *)((char *)map + DCACHE_HDR_SIZE);
+
+	return 0;
+}
+
+static void
+unmap_file(struct dcache *dc)
+{
+	if (dc->hdr)
+	{
+		munmap((void *)dc->hdr, dc->map_size);
+		dc->hdr = NULL;
+		dc->slots = NULL;
+		dc->map_size = 0;
+	}
+}
+
+/*
+ * Make FD an empty cache of NR_SLOTS entries.
+ */
+static int
+init_file(int fd, uint64_t nr_slots, uint32_t generation)
+{
+	struct dcache_header	hdr;
+
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, DCACHE_FILE_SIZE(nr_slots)) < 0)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = DCACHE_MAGIC;
+	hdr.version = DCACHE_VERSION;
+	hdr.nr_slots = nr_slots;
+	hdr.nr_used = 0;
+	hdr.generation = generation;
+	hdr.dirty = 0;
+
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+		return -1;
+
+	return 0;
+}
+
+char *
+dcache_default_path(void)
+{
+	char	*base = NULL;
+	char	*path = NULL;
+	size_t	len = 0;
+
+	if ((base = getenv("XDG_CACHE_HOME")) && *base)
+	{
+		len = strlen(base) + sizeof("/pollux/" DCACHE_FILE_NAME);
+		if (!(path = calloc(len, 1)))
+			return NULL;
+
+		sprintf(path, "%s", base);
+	}
+	else
+	if ((base = getenv("HOME")))
+	{
+		len = strlen(base) + sizeof("/.cache/pollux/" DCACHE_FILE_NAME);
+		if (!(path = calloc(len, 1)))
+			return NULL;
+
+		sprintf(path, "%s/.cache", base);
+	}
+	else
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+
+	mkdir(path, S_IRWXU);
+	strcat(path, "/pollux");
+	mkdir(path, S_IRWXU);
+	strcat(path, "/" DCACHE_FILE_NAME);
+
+	return path;
+}
+
+/*
+ * Open (creating it if need be) the cache at PATH. The cache is locked
+ * for as long as it is open; if another process has it, NULL is
+ * returned with errno set to EWOULDBLOCK.
+ */
+struct dcache *
+dcache_open(const char *path)
+{
+	struct dcache		*dc = NULL;
+	struct stat		statb;
+	uint64_t		i;
+	int			_errno = 0;
+
+	if (!(dc = calloc(1, sizeof(struct dcache))))
+		return NULL;
+
+	dc->fd = -1;
+
+	if (!(dc->path = strdup(path)))
+		goto fail;
+
+	if ((dc->fd = open(path, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0)
+		goto fail;
+
+	if (flock(dc->fd, LOCK_EX|LOCK_NB) < 0)
+		goto fail;
+
+	if (fstat(dc->fd, &statb) < 0)
+		goto fail;
+
+	if ((size_t)statb.st_size < DCACHE_FILE_SIZE(1))
+	{
+		if (init_file(dc->fd, DCACHE_INITIAL_SLOTS, 0) < 0)
+			goto fail;
+
+		statb.st_size = DCACHE_FILE_SIZE(DCACHE_INITIAL_SLOTS);
+	}
+
+	if (map_file(dc, dc->fd, statb.st_size) < 0)
+		goto fail;
+
+	/*
+	 * Anything we do not recognise (or that is not a power-of-two
+	 * sized table that fits the file) is thrown away.
+	 */
+	if (dc->hdr->magic != DCACHE_MAGIC
+		|| dc->hdr->version != DCACHE_VERSION
+		|| dc->hdr->nr_slots == 0
+		|| (dc->hdr->nr_slots & (dc->hdr->nr_slots - 1))
+		|| DCACHE_FILE_SIZE(dc->hdr->nr_slots) != (size_t)statb.st_size)
+	{
+		unmap_file(dc);
+
+		if (init_file(dc->fd, DCACHE_INITIAL_SLOTS, 0) < 0)
+			goto fail;
+
+		if (map_file(dc, dc->fd, DCACHE_FILE_SIZE(DCACHE_INITIAL_SLOTS)) < 0)
+			goto fail;
+	}
+
+	/*
+	 * Not closed cleanly last time: the count of used
+	 * slots in the header cannot be trusted.
+	 */
+	if (dc->hdr->dirty)
+	{
+		dc->hdr->nr_used = 0;
+
+		for (i = 0; i < dc->hdr->nr_slots; ++i)
+		{
+			if (!entry_empty(&dc->slots[i]))
+				++dc->hdr->nr_used;
+		}
+	}
+
+	++dc->hdr->generation;
+	dc->hdr->dirty = 1;
+	msync((void *)dc->hdr, DCACHE_HDR_SIZE, MS_SYNC);
+
+	return dc;
+
+	fail:
+	_errno = errno;
+
+	unmap_file(dc);
+
+	if (dc->fd != -1)
+		close(dc->fd);
+
+	free(dc->path);
+	free(dc);
+
+	errno = _errno;
+	return NULL;
+}
+
+/*
+ * Look up the digest of the file described by STATB for the algorithm
+ * ALGO. Returns 1 and fills DIGEST/LEN on a hit; 0 if there is no entry
+ * or the file has changed since the entry was made.
+ */
+int
+dcache_lookup(struct dcache *dc, const struct stat *statb, int algo, unsigned char *digest, unsigned int size, unsigned int *len)
+{
+	struct dcache_entry	*e = NULL;
+
+	if (!(e = find_slot(dc, statb->st_dev, statb->st_ino, algo, NULL)))
+	{
+		++dc->stats.misses;
+		return 0;
+	}
+
+	if (e->size != (uint64_t)statb->st_size
+		|| e->mtime_ns != ts_to_ns(statb->st_mtim)
+		|| e->ctime_ns != ts_to_ns(statb->st_ctim)
+		|| e->dlen != algo_size(algo)
+		|| e->dlen > size)
+	{
+		++dc->stats.stale;
+		++dc->stats.misses;
+		return 0;
+	}
+
+	memcpy(digest, e->digest, e->dlen);
+	*len = e->dlen;
+
+	if (e->generation != dc->hdr->generation)
+	{
+		e->generation = dc->hdr->generation;
+		e->check = entry_check(e);
+	}
+
+	++dc->stats.hits;
+	return 1;
+}
+
+/*
+ * Save the digest of the file described by STATB, replacing any
+ * (stale) entry there was for it. Entries are 128 bytes and aligned
+ * to 128 bytes, so one never straddles a disk sector.
+ */
+int
+dcache_store(struct dcache *dc, const struct stat *statb, int algo, const unsigned char *digest, unsigned int len)
+{
+	struct dcache_entry	*e = NULL;
+	struct dcache_entry	*free_slot = NULL;
+
+	if (len > DCACHE_DIGEST_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(e = find_slot(dc, statb->st_dev, statb->st_ino, algo, &free_slot)))
+	{
+		/* keep the load factor under 0.7 */
+		if (((dc->hdr->nr_used + 1) * 10) > (dc->hdr->nr_slots * 7))
+		{
+			if (dcache_compact(dc, (dc->hdr->nr_slots << 1)) < 0)
+				return -1;
+
+			find_slot(dc, statb->st_dev, statb->st_ino, algo, &free_slot);
+		}
+
+		if (!(e = free_slot))
+		{
+			errno = ENOSPC;
+			return -1;
+		}
+
+		if (entry_empty(e))
+			++dc->hdr->nr_used;
+	}
+
+	e->check = 0;
+	e->dev = statb->st_dev;
+	e->ino = statb->st_ino;
+	e->size = statb->st_size;
+	e->mtime_ns = ts_to_ns(statb->st_mtim);
+	e->ctime_ns = ts_to_ns(statb->st_ctim);
+	e->algo = algo;
+	e->generation = dc->hdr->generation;
+	e->dlen = len;
+	memset(e->digest, 0, DCACHE_DIGEST_MAX);
+	memcpy(e->digest, digest, len);
+	memset(e->__pad, 0, sizeof(e->__pad));
+	e->check = entry_check(e);
+
+	++dc->stats.stored;
+	return 0;
+}
+
+/*
+ * Rebuild the cache in a table of NR_SLOTS entries (rounded up to a power
+ * of two), leaving out torn entries and those that have not been used in
+ * the last DCACHE_MAX_AGE runs. The new table is written to a temporary
+ * file that then replaces the cache with rename(), so a crash at any point
+ * leaves either the old or the new cache intact.
+ */
+int
+dcache_compact(struct dcache *dc, uint64_t nr_slots)
+{
+	struct dcache		new_dc;
+	struct dcache_entry	*e = NULL;
+	struct dcache_entry	*free_slot = NULL;
+	char			*tmp_path = NULL;
+	uint64_t		i, n;
+	int			fd = -1;
+	int			_errno = 0;
+
+	for (n = DCACHE_INITIAL_SLOTS; n < nr_slots; n <<= 1)
+		;
+
+	memset(&new_dc, 0, sizeof(new_dc));
+
+	if (!(tmp_path = calloc(strlen(dc->path) + sizeof(".tmp"), 1)))
+		return -1;
+
+	sprintf(tmp_path, "%s.tmp", dc->path);
+
+	if ((fd = open(tmp_path, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) < 0)
+		goto fail;
+
+	if (flock(fd, LOCK_EX|LOCK_NB) < 0)
+		goto fail;
+
+	if (init_file(fd, n, dc->hdr->generation) < 0)
+		goto fail;
+
+	if (map_file(&new_dc, fd, DCACHE_FILE_SIZE(n)) < 0)
+		goto fail;
+
+	for (i = 0; i < dc->hdr->nr_slots; ++i)
+	{
+		e = &dc->slots[i];
+
+		if (entry_empty(e))
+			continue;
+
+		if (!entry_valid(e) || !entry_current(dc, e))
+		{
+			++dc->stats.dropped;
+			continue;
+		}
+
+		if (find_slot(&new_dc, e->dev, e->ino, e->algo, &free_slot) || !free_slot)
+			continue;
+
+		memcpy(free_slot, e, sizeof(*e));
+		++new_dc.hdr->nr_used;
+	}
+
+	new_dc.hdr->dirty = 1;
+
+	if (msync((void *)new_dc.hdr, new_dc.map_size, MS_SYNC) < 0 || fsync(fd) < 0)
+		goto fail;
+
+	if (rename(tmp_path, dc->path) < 0)
+		goto fail;
+
+	unmap_file(dc);
+	close(dc->fd);
+
+	dc->fd = fd;
+	dc->map_size = new_dc.map_size;
+	dc->hdr = new_dc.hdr;
+	dc->slots = new_dc.slots;
+
+	free(tmp_path);
+	return 0;
+
+	fail:
+	_errno = errno;
+
+	unmap_file(&new_dc);
+
+	if (fd != -1)
+	{
+		close(fd);
+		unlink(tmp_path);
+	}
+
+	free(tmp_path);
+	errno = _errno;
+	return -1;
+}
+
+/*
+ * Let go of the pages of the mapping that are resident (they are
+ * written back first, and read back in as entries are used again),
+ * to make room when memory is short.
+ */
+void
+dcache_trim(struct dcache *dc)
+{
+	if (!dc || !dc->hdr)
+		return;
+
+#ifdef MADV_PAGEOUT
+	if (madvise((void *)dc->hdr, dc->map_size, MADV_PAGEOUT) == 0)
+		return;
+#endif
+
+	msync((void *)dc->hdr, dc->map_size, MS_SYNC);
+	madvise((void *)dc->hdr, dc->map_size, MADV_DONTNEED);
+	posix_fadvise(dc->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Close the cache, compacting it first if at least a quarter of its
+ * entries are torn or have not been used for DCACHE_MAX_AGE runs.
+ */
+void
+dcache_close(struct dcache *dc)
+{
+	uint64_t	i;
+	uint64_t	nr_old = 0;
+	uint64_t	nr_live = 0;
+
+	if (!dc)
+		return;
+
+	if (dc->hdr)
+	{
+		for (i = 0; i < dc->hdr->nr_slots; ++i)
+		{
+			if (entry_empty(&dc->slots[i]))
+				continue;
+
+			if (!entry_valid(&dc->slots[i]) || !entry_current(dc, &dc->slots[i]))
+				++nr_old;
+			else
+				++nr_live;
+		}
+
+		if (nr_old && (nr_old << 2) >= dc->hdr->nr_used)
+			dcache_compact(dc, (nr_live << 1));
+
+		msync((void *)dc->hdr, dc->map_size, MS_SYNC);
+		dc->hdr->dirty = 0;
+		msync((void *)dc->hdr, DCACHE_HDR_SIZE, MS_SYNC);
+
+		unmap_file(dc);
+	}
+
+	if (dc->fd != -1)
+		close(dc->fd);
+
+	free(dc->path);
+	free(dc);
+
+	return;
+}
+
+/*
+ * Name of the extended attribute that holds the digest for ALGO.
+ */
+static int
+xattr_name(char *name, size_t size, int algo)
+{
+	const char	*sn = NULL;
+	size_t		i, len;
+
+	if (!(sn = OBJ_nid2sn(algo)))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	len = strlen(DCACHE_XATTR_PREFIX);
+
+	if ((len + strlen(sn)) >= size)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(name, DCACHE_XATTR_PREFIX);
+
+	for (i = 0; sn[i]; ++i)
+		name[len + i] = tolower((unsigned char)sn[i]);
+
+	name[len + i] = 0;
+
+	return 0;
+}
+
+/*
+ * Get the digest (for the algorithm ALGO) kept in the extended
+ * attributes of PATH, if the file still has the size and mtime in
+ * STATB it was computed for. Returns 1 on a hit, 0 otherwise.
+ */
+int
+dcache_xattr_get(const char *path, const struct stat *statb, int algo, unsigned char *digest, unsigned int size, unsigned int *len)
+{
+	struct dcache_xattr	xa;
+	char			name[64];
+	ssize_t			n = 0;
+
+	if (xattr_name(name, sizeof(name), algo) < 0)
+		return 0;
+
+	if ((n = lgetxattr(path, name, &xa, sizeof(xa))) < (ssize_t)DCACHE_XATTR_HDR_SIZE)
+		return 0;
+
+	if (xa.version != DCACHE_XATTR_VERSION
+		|| xa.dlen != algo_size(algo)
+		|| xa.dlen > size
+		|| (size_t)n != (DCACHE_XATTR_HDR_SIZE + xa.dlen)
+		|| le32toh(xa.algo) != (uint32_t)algo
+		|| le64toh(xa.size) != (uint64_t)statb->st_size
+		|| (int64_t)le64toh(xa.mtime_ns) != ts_to_ns(statb->st_mtim))
+		return 0;
+
+	memcpy(digest, xa.digest, xa.dlen);
+	*len = xa.dlen;
+
+	return 1;
+}
+
+/*
+ * Keep the digest of PATH in its extended attributes. Fails quietly
+ * (returning -1) where that is not possible: no write permission,
+ * read-only file systems, or file systems without user xattrs.
+ */
+int
+dcache_xattr_set(const char *path, const struct stat *statb, int algo, const unsigned char *digest, unsigned int len)
+{
+	struct dcache_xattr	xa;
+	char			name[64];
+
+	if (len > DCACHE_DIGEST_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (xattr_name(name, sizeof(name), algo) < 0)
+		return -1;
+
+	memset(&xa, 0, sizeof(xa));
+	xa.version = DCACHE_XATTR_VERSION;
+	xa.dlen = len;
+	xa.algo = htole32(algo);
+	xa.size = htole64(statb->st_size);
+	xa.mtime_ns = htole64(ts_to_ns(statb->st_mtim));
+	memcpy(xa.digest, digest, len);
+
+	return lsetxattr(path, name, &xa, (DCACHE_XATTR_HDR_SIZE + len), 0);
+}
@@ -0,0 +1,126 @@
+#ifndef DIGEST_CACHE_H
+#define DIGEST_CACHE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Persistent digest cache.
+ *
+ * Maps the identity of a file (device, inode) and the digest algorithm
+ * (an OpenSSL NID) to the digest computed for it; the entry is only
+ * trusted while the file's size, mtime and ctime (to the nanosecond)
+ * are those it was computed for.
+ *
+ * The cache is an open-addressing hash table of fixed-size entries in
+ * a single file, mapped into memory. Each entry carries a checksum, so
+ * an entry torn by a crash is simply treated as a miss; the file is
+ * only ever replaced as a whole by rename(), when it is compacted.
+ */
+
+#define DCACHE_MAGIC		0x44584c50u /* "PLXD" */
+#define DCACHE_VERSION		2
+#define DCACHE_DIGEST_MAX	64
+#define DCACHE_INITIAL_SLOTS	4096
+#define DCACHE_FILE_NAME	"digests.db"
+
+/*
+ * Entries not used by the last DCACHE_MAX_AGE runs are
+ * dropped the next time the cache is compacted.
+ */
+#define DCACHE_MAX_AGE		16
+
+/*
+ * The header takes up as much room as an entry, so that
+ * the entries after it are aligned to their size as well.
+ */
+struct dcache_header
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	nr_slots;
+	uint64_t	nr_used;
+	uint32_t	generation;
+	uint32_t	dirty;
+	unsigned char	__pad[96];
+};
+
+struct dcache_entry
+{
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	int64_t		mtime_ns;
+	int64_t		ctime_ns;
+	uint32_t	algo;
+	uint32_t	generation;
+	uint32_t	dlen;
+	uint32_t	check;
+	unsigned char	digest[DCACHE_DIGEST_MAX];
+	unsigned char	__pad[8];
+};
+
+/*
+ * The digest can also be kept with the file itself, in an extended
+ * attribute named DCACHE_XATTR_PREFIX followed by the (lower-case)
+ * short name of the algorithm, e.g. "user.pollux.sha256", so that it
+ * travels with copies of the file. The ctime cannot be used there (it
+ * is not preserved by copies, and setting the attribute changes it),
+ * so the entry is validated against the size and mtime only. Integers
+ * are stored little-endian.
+ */
+#define DCACHE_XATTR_PREFIX	"user.pollux."
+#define DCACHE_XATTR_VERSION	1
+
+struct dcache_xattr
+{
+	uint8_t		version;
+	uint8_t		dlen;
+	uint16_t	__pad;
+	uint32_t	algo;
+	uint64_t	size;
+	int64_t		mtime_ns;
+	unsigned char	digest[DCACHE_DIGEST_MAX];
+} __attribute__((__packed__));
+
+#define DCACHE_XATTR_HDR_SIZE offsetof(struct dcache_xattr, digest)
+
+struct dcache_stats
+{
+	uint64_t	hits;
+	uint64_t	misses;
+	uint64_t	stale;
+	uint64_t	stored;
+	uint64_t	dropped;
+};
+
+struct dcache
+{
+	char			*path;
+	int			fd;
+	size_t			map_size;
+	struct dcache_header	*hdr;
+	struct dcache_entry	*slots;
+	struct dcache_stats	stats;
+};
+
+struct dcache *dcache_open(const char *);
+void dcache_close(struct dcache *);
+int dcache_lookup(struct dcache *, const struct stat *, int, unsigned char *, unsigned int, unsigned int *);
+int dcache_store(struct dcache *, const struct stat *, int, const unsigned char *, unsigned int);
+int dcache_compact(struct dcache *, uint64_t);
+void dcache_trim(struct dcache *);
+char *dcache_default_path(void);
+int dcache_xattr_get(const char *, const struct stat *, int, unsigned char *, unsigned int, unsigned int *);
+int dcache_xattr_set(const char *, const struct stat *, int, const unsigned char *, unsigned int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined DIGEST_CACHE_H */
@@ -10,9 +10,14 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <iostream>
-#include <list>
-#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <gtk/gtk.h>
+#include "../digest.h"
+#include "../digest_cache.h"
+#include "../size_index.h"
 
 #define PROG_NAME "Pollux"
 #define PROG_NAME_DBUS "org.gtk.pollux"
@@ -30,10 +35,9 @@
 # define PATH_MAX 1024
 #endif
 
-guint DIGEST_SIZE = 0;
-EVP_MD *__default_digest = (EVP_MD *)EVP_md5();
+static char const hexchars[17] = "0123456789abcdef";
 
-static gchar *get_file_digest(gchar *) __nonnull((1)) __wur;
+static gint get_file_digest(gchar *, unsigned char *) __nonnull((1,2)) __wur;
 
 static struct sigaction sigint_old;
 static struct sigaction sigint_new;
@@ -41,6 +45,7 @@ static sigjmp_buf __root_env__;
 
 typedef void (*gcallback_t)(GtkWidget *, gpointer);
 
+static void set_digest(gint);
 void on_digest_select(GtkWidget *, gpointer);
 void on_option_select(GtkWidget *, gpointer);
 void create_window(void);
@@ -64,9 +69,6 @@ static GtkWidget *options_menu;
 static GtkWidget *digests_menu;
 static GtkWidget *item_options;
 static GtkWidget *item_digests;
-static GtkWidget item_digest_md5;
-static GtkWidget item_digest_sha256;
-static GtkWidget item_digest_sha512;
 
 static GtkWidget *stats_nr_files;
 static GtkWidget *sep1;
@@ -181,13 +183,7 @@ struct Runtime_Option options[NR_OPTIONS] =
 	{ &delete_all, OPTION_DELETE_ALL, "Delete all (no prompt)", on_option_select }
 };
 
-enum
-{
-	DIGEST_MD5,
-	DIGEST_SHA256,
-	DIGEST_SHA512,
-	NR_DIGESTS
-};
+#define NR_DIGESTS NR_PLX_DIGESTS
 
 struct Digest
 {
@@ -197,12 +193,11 @@ struct Digest
 	gcallback_t func;
 };
 
-static struct Digest menu_digests[NR_DIGESTS] =
-{
-	{ &item_digest_md5, DIGEST_MD5, (const gchar *)"MD5", on_digest_select },
-	{ &item_digest_sha256, DIGEST_SHA256, (const gchar *)"SHA256", on_digest_select },
-	{ &item_digest_sha512, DIGEST_SHA512, (const gchar *)"SHA512", on_digest_select }
-};
+/*
+ * Filled in from plx_digests[] by create_menu_bar(), for
+ * those digests this build of OpenSSL has.
+ */
+static struct Digest menu_digests[NR_DIGESTS];
 
 struct POLLUX_CTX
 {
@@ -217,27 +212,99 @@ struct POLLUX_CTX
 #define set_option(o) (CTX.runtime_options |= (o))
 #define unset_option(o) (CTX.runtime_options &= ~(o))
 
-#define __DEFAULT_DIGEST DIGEST_MD5
-
 struct POLLUX_CTX CTX =
 {
 	"",
-	__DEFAULT_DIGEST,
+	-1,
 	~(1u),
 	FALSE,
 	(EVP_MD *)NULL
 };
 
+/*
+ * Digest policy: what the index needs to know about a digest, fixed at
+ * compile time. A digest of N bytes is kept as a KEY of whole 64-bit
+ * words (zero-padded), so that comparing two digests is a handful of
+ * word compares instead of a memcmp() of a length read from memory.
+ * The index, the buckets and the map of duplicates are instantiated
+ * once for each digest length (see on_start_scan()).
+ */
+template <guint N>
+struct DigestPolicy
+{
+	static constexpr guint size = N;
+	static constexpr guint words = (N + 7) / 8;
+
+	struct key
+	{
+		uint64_t w[words];
+
+		bool operator==(const key& k) const
+		{
+			uint64_t diff = 0;
+
+			for (guint i = 0; i < words; ++i)
+				diff |= (this->w[i] ^ k.w[i]);
+
+			return diff == 0;
+		}
+
+		bool operator<(const key& k) const
+		{
+			for (guint i = 0; i < words; ++i)
+			{
+				if (this->w[i] != k.w[i])
+					return this->w[i] < k.w[i];
+			}
+
+			return false;
+		}
+	};
+
+/*
+ * The first word of the digest is its hash (see digest.h).
+ */
+	struct hash
+	{
+		size_t operator()(const key& k) const
+		{
+			return (size_t)k.w[0];
+		}
+	};
+
+	static void load(key& k, const unsigned char *digest)
+	{
+		memset(&k, 0, sizeof(k));
+		memcpy(k.w, digest, N);
+	}
+
+	static gchar *hexlify(const key& k, gchar *hex)
+	{
+		const unsigned char *p = (const unsigned char *)k.w;
+		guint i;
+
+		for (i = 0; i < N; ++i)
+		{
+			hex[(i << 1)] = hexchars[((p[i] >> 4) & 0xf)];
+			hex[(i << 1) + 1] = hexchars[(p[i] & 0xf)];
+		}
+
+		hex[(N << 1)] = 0;
+
+		return hex;
+	}
+};
+
+template <class P>
 class fNode
 {
 	public:
 
-	gchar *digest;
+	typedef typename P::key key_type;
+
+	key_type digest;
 	gchar *name;
 	gsize size;
-	fNode *left;
-	fNode *right;
-	fNode *parent;
 
 	fNode();
 	~fNode();
@@ -262,56 +329,62 @@ class fNode
 		this->added = tvalue;
 	}
 
-	void add_to_bucket(fNode& node)
+/*
+ * A file of the same size with a different digest. ADDED is
+ * set once it is in the duplicates, as for the node itself.
+ */
+	struct bucket_entry
+	{
+		key_type digest;
+		std::string name;
+		bool added;
+
+		bucket_entry(gchar *name, const key_type& digest) : digest(digest), name(name), added(false) {}
+	};
+
+	void add_to_bucket(gchar *name, const key_type& digest)
 	{
-		this->bucket.push_back(node);
-		this->nr_bucket += 1;
+		this->bucket.emplace_back(name, digest);
 	}
 
-	bool bucket_contains(gchar *digest, gsize size)
+	bucket_entry *bucket_find(const key_type& digest)
 	{
-		for (std::list<fNode>::iterator it = this->bucket.begin(); it != this->bucket.end(); ++it)
+		for (typename std::vector<bucket_entry>::iterator it = this->bucket.begin(); it != this->bucket.end(); ++it)
 		{
-			if (!memcmp(digest, it->digest, size))
+			if (digest == it->digest)
 			{
-				return true;
+				return &*it;
 			}
 		}
 
-		return false;
+		return NULL;
 	}
 
 	gint nr_items_bucket(void)
 	{
-		return this->nr_bucket;
+		return (gint)this->bucket.size();
 	}
 
 	private:
 
 	bool have_digest;
 	bool added;
-	std::list<fNode> bucket;
-	gsize nr_bucket;
+	std::vector<bucket_entry> bucket;
 };
 
-fNode::fNode(void)
+template <class P>
+fNode<P>::fNode(void)
 {
-	this->digest = NULL;
+	memset(&this->digest, 0, sizeof(this->digest));
 	this->name = NULL;
 	this->size = 0;
-	this->left = NULL;
-	this->right = NULL;
-	this->parent = NULL;
 	this->have_digest = false;
 	this->added = false;
-	this->nr_bucket = 0;
 }
 
-fNode::~fNode(void)
+template <class P>
+fNode<P>::~fNode(void)
 {
-	if (this->digest)
-		free(this->digest);
-
 	if (this->name)
 		free(this->name);
 }
@@ -323,62 +396,45 @@ class dNode
 {
 	public:
 
-	gchar *name;
+	std::string name;
 
-	dNode();
+	dNode(const gchar *);
 };
 
-dNode::dNode(void)
+dNode::dNode(const gchar *name) : name(name)
 {
-	this->name = NULL;
 }
 
 /*
- * Now using a map of type std::map<gchar *,std::list<dNode> >
- *
- * Gives O(log(N)) search time to find the linked list of
- * files that match the digest (which is the key).
- */
-#if 0
-/*
- * Linked list of digests, containing
- * a head pointer to linked list of
- * all the files that have this digest.
+ * A set of files with the same digest. The files are kept
+ * back to back, moved (not copied) when the vector grows.
  */
-class dList
+template <class P>
+class dSet
 {
 	public:
 
-	gsize nr_nodes;
-	std::list<dNode> files;
-
-	dList();
+	typename P::key digest;
+	std::vector<dNode> files;
 
-	gint get_nr_items(void)
-	{
-		return this->nr_nodes;
-	}
-
-	gint add_node(dNode node)
-	{
-		this->files.push_back(node);
-		this->nr_nodes += 1;
-	}
+	dSet(const typename P::key&);
 };
 
-dList::dList(void)
+template <class P>
+dSet<P>::dSet(const typename P::key& digest) : digest(digest)
 {
-	this->digest = NULL;
-	this->nr_nodes = 0;
 }
-#endif
 
+template <class P>
 class fTree
 {
 	public:
 
+	typedef typename P::key key_type;
+	typedef fNode<P> node_type;
+
 	gsize nr_nodes;
-	std::map<gchar *,std::list<dNode> > dup_list;
+	std::vector<dSet<P> > dup_list;
 
 	fTree();
 	~fTree();
@@ -387,6 +443,10 @@ class fTree
 	{
 		struct stat statb;
 		gsize size;
+		unsigned char digest[EVP_MAX_MD_SIZE];
+#ifdef DEBUG
+		gchar hex[(P::size << 1) + 1];
+#endif
 
 		lstat(name, &statb);
 		size = statb.st_size;
@@ -394,294 +454,178 @@ class fTree
 		INC_NR_FILES();
 		INC_BYTES_TOTAL(size);
 
-		if (!this->root)
-		{
-			this->root = new fNode();
-			this->root->name = strdup(name);
-			this->root->size = size;
-			this->root->left = NULL;
-			this->root->right = NULL;
-			this->root->parent = NULL;
-			this->nr_nodes += 1;
-
-			return;
-		}
+		node_type **slot = reinterpret_cast<node_type **>(size_index_get(&this->sizes, size, 1));
 
-		fNode *n = this->root;
+		if (!slot)
+			g_error("Failed to grow the size index");
 
-		while (true)
+		if (!*slot)
 		{
-			if (size < n->size)
-			{
-				if (!n->left)
-				{
-					n->left = new fNode();
-					n->left->name = strdup(name);
-					n->left->size = size;
-					n->left->parent = n;
-					this->nr_nodes += 1;
-#ifdef DEBUG
-					std::cerr << "Inserted @ " << &n->left << std::endl;
-#endif
-					return;
-				}
-				else
-				{
-					n = n->left;
-					continue;
-				}
-			}
-			else
-			if (size > n->size)
-			{
-				if (!n->right)
-				{
-					n->right = new fNode();
-					n->right->name = strdup(name);
-					n->right->size = size;
-					n->right->parent = n;
-					this->nr_nodes += 1;
+			*slot = new node_type();
+			(*slot)->name = strdup(name);
+			(*slot)->size = size;
+			this->nr_nodes += 1;
 #ifdef DEBUG
-					std::cerr << "Inserted @ %p " << &n->right << std::endl;
+			std::cerr << "Inserted @ " << *slot << std::endl;
 #endif
-					return;
-				}
-				else
-				{
-					n = n->right;
-					continue;
-				}
-			}
-			else /* size == n->size */
-			{
-				if (n->has_digest() == false)
-				{
+			return;
+		}
+
 /*
- * get_file_digest() returns pointer to static memory so we
- * must use strdup() to save it.
+ * Same size as the first file of that size.
  */
-					gchar *tmp = get_file_digest(n->name);
-					if (!tmp)
-						return;
+		node_type *n = *slot;
+
+		if (n->has_digest() == false)
+		{
+			if (get_file_digest(n->name, digest) < 0)
+				return;
 
-					n->digest = strdup(tmp);
-					n->got_digest(true);
+			P::load(n->digest, digest);
+			n->got_digest(true);
 #ifdef DEBUG
-					std::cerr << "Got digest of \"" << n->name << "\" at current node: " << n->digest << std::endl;
+			std::cerr << "Got digest of \"" << n->name << "\" at current node: " << P::hexlify(n->digest, hex) << std::endl;
 #endif
-				}
+		}
 
-/*
- * Don't need to strdup() this one because either we
- * will find that we don't need to keep it (cause the
- * hash is already in our bucket of digests), or we will
- * be calling strdup() later to save it at the end of
- * the bucket.
- */
-				gchar *cur_digest = get_file_digest(name);
+		key_type cur_digest;
+
+		if (get_file_digest(name, digest) < 0)
+			return;
 
-				if (!cur_digest)
-					return;
+		P::load(cur_digest, digest);
 
 #ifdef DEBUG
-				std::cerr << "Got digest of current file \"" << name << "\": " << cur_digest << std::endl;
+		std::cerr << "Got digest of current file \"" << name << "\": " << P::hexlify(cur_digest, hex) << std::endl;
 #endif
 
-				if (!memcmp(cur_digest, n->digest, DIGEST_SIZE))
-				{
-					INC_NR_FILES();
-					INC_BYTES_WASTED(size);
+		if (cur_digest == n->digest)
+		{
+			INC_NR_FILES();
+			INC_BYTES_WASTED(size);
 
-					if (n->been_added() == false)
-					{
+			if (n->been_added() == false)
+			{
 #ifdef DEBUG
-						std::cerr << "Adding duplicate file to linked list" << std::endl;
+				std::cerr << "Adding duplicate file to linked list" << std::endl;
 #endif
-						this->add_dup_file(n->name, n->digest);
-					}
+				this->add_dup_file(n->name, n->digest);
+				n->set_added(true);
+			}
 
 #ifdef DEBUG
-					std::cerr << "Adding duplicate file to linked list" << std::endl;
+			std::cerr << "Adding duplicate file to linked list" << std::endl;
 #endif
-					this->add_dup_file(name, cur_digest);
+			this->add_dup_file(name, cur_digest);
 
-					break;
-				}
-				else
-				{
+			return;
+		}
+		else
+		{
 /*
  * O(N) check of our bucket of digests to see if this
  * hash is already in there. If not, save this one
  * at the end of the bucket.
  */
 #ifdef DEBUG
-					std::cerr << "Searching bucket for matching digest" << std::endl;
-#endif
-					if (n->nr_items_bucket() > 0)
-					{
-						gint i;
-						gint nr_bucket = n->nr_items_bucket();
-						bool is_dup = false;
-						gint idx;
-
-						if (n->bucket_contains(cur_digest, DIGEST_SIZE))
-						{
-							INC_NR_FILES();
-							INC_BYTES_WASTED(size);
-#ifdef DEBUG
-							std::cerr << "Found match in bucket. Inserting duplicate file to linked list" << std::endl;
+			std::cerr << "Searching bucket for matching digest" << std::endl;
 #endif
-							this->add_dup_file(name, cur_digest);
-							is_dup = true;
-						}
+			typename node_type::bucket_entry *b;
 
-						if (is_dup == false)
-						{
+			if (n->nr_items_bucket() > 0 && (b = n->bucket_find(cur_digest)))
+			{
+				INC_NR_FILES();
+				INC_BYTES_WASTED(size);
 #ifdef DEBUG
-							std::cerr << "No match in bucket. Adding file to bucket" << std::endl;
+				std::cerr << "Found match in bucket. Inserting duplicate file to linked list" << std::endl;
 #endif
-							fNode _node;
-							_node.name = strdup(name);
-							_node.digest = strdup(cur_digest);
-
-							n->add_to_bucket(_node);
-							return;
-						}
-					}
-					else /* n->nr_items_bucket() == 0 */
-					{
+				if (b->added == false)
+				{
+					this->add_dup_file(b->name.c_str(), b->digest);
+					b->added = true;
+				}
+
+				this->add_dup_file(name, cur_digest);
+				return;
+			}
+
 #ifdef DEBUG
-						std::cerr << "Adding first file to bucket" << std::endl;
+			std::cerr << "No match in bucket. Adding file to bucket" << std::endl;
 #endif
-						fNode _node;
-						_node.name = strdup(name);
-						_node.digest = strdup(cur_digest);
-
-						n->add_to_bucket(_node);
-						return;
-					}
-				} /* cur_digest != n->digest */
-			} /* size == n->size */
-		} /* while (true) */
+			n->add_to_bucket(name, cur_digest);
+			return;
+		} /* cur_digest != n->digest */
 	}
 
 	void show_duplicates(void)
 	{
+		gchar hex[(P::size << 1) + 1];
+
 #ifdef DEBUG
 		std::cerr << "Showing list of duplicate files" << std::endl;
 #endif
-		for (std::map<gchar *,std::list<dNode> >::iterator map_it = this->dup_list.begin(); map_it != this->dup_list.end(); ++map_it)
+		for (typename std::vector<dSet<P> >::iterator set_it = this->dup_list.begin(); set_it != this->dup_list.end(); ++set_it)
 		{
-			std::cerr << "** [" << map_it->first << "] **\n" << std::endl;
-			for (std::list<dNode>::iterator node_it = map_it->second.begin(); node_it != map_it->second.end(); ++node_it)
+			std::cerr << "** [" << P::hexlify(set_it->digest, hex) << "] **\n" << std::endl;
+			for (std::vector<dNode>::iterator node_it = set_it->files.begin(); node_it != set_it->files.end(); ++node_it)
 			{
 				std::cerr << node_it->name << std::endl;
 			}
 
 			std::cerr << "\n\n\n";
 		}
-
-#ifdef DEBUG
-		for (std::map<gchar *,std::list<dNode> >::iterator map_it = this->dup_list.begin(); map_it != this->dup_list.end(); ++map_it)
-			std::cerr << map_it->first << std::endl;
-#endif
 	}
 
 	private:
 
-	void add_dup_file(gchar *name, gchar *digest)
+/*
+ * The sets of duplicates are kept in the order they were
+ * found; DUP_INDEX maps a digest to its set in DUP_LIST,
+ * so adding a file is O(1) on average.
+ */
+	void add_dup_file(const gchar *name, const key_type& digest)
 	{
-		dNode node;
+		std::pair<typename std::unordered_map<key_type,gsize,typename P::hash>::iterator,bool> r;
 
-		node.name = strdup(name);
+		r = this->dup_index.emplace(digest, this->dup_list.size());
 
-		for (std::map<gchar *,std::list<dNode> >::iterator map_it = this->dup_list.begin(); map_it != this->dup_list.end(); ++map_it)
-		{
-			if (!memcmp(digest, map_it->first, DIGEST_SIZE))
-			{
-				map_it->second.push_back(node);
-				return;
-			}
-		}
-
-		std::list<dNode> new_list;
+		if (r.second)
+			this->dup_list.emplace_back(digest);
 
-		new_list.push_back(node);
-		this->dup_list[digest] = new_list;
+		this->dup_list[r.first->second].files.emplace_back(name);
 
 		return;
 	}
 
-	fNode *root;
+	std::unordered_map<key_type,gsize,typename P::hash> dup_index;
+	struct size_index sizes;
 };
 
-fTree::fTree(void)
+template <class P>
+fTree<P>::fTree(void)
 {
 	this->nr_nodes = 0;
-	this->root = NULL;
+
+	if (size_index_init(&this->sizes) < 0)
+		g_error("Failed to allocate the size index");
 }
 
-fTree::~fTree(void)
+template <class P>
+fTree<P>::~fTree(void)
 {
-	for (std::map<gchar *,std::list<dNode> >::iterator map_iter = this->dup_list.begin(); map_iter != this->dup_list.end(); ++map_iter)
-	{
-		for (std::list<dNode>::iterator list_iter = map_iter->second.begin(); list_iter != map_iter->second.end(); ++list_iter)
-		{
-			if (list_iter->name)
-			{
-				free(list_iter->name);
-				list_iter->name = NULL;
-			}
-		}
-	}
+	this->dup_index.clear();
 	this->dup_list.clear();
 
-	if (this->root)
-	{
-		fNode *node = this->root;
-		fNode *parent = NULL;
-
-		while (true)
-		{
-			if (!node->left && !node->right)
-			{
-				parent = node->parent;
-
-				if (parent)
-				{
-					if (parent->left == node)
-						parent->left = NULL;
-					else
-						parent->right = NULL;
-				}
-
-				free(node);
-
-				if (!parent)
-					break;
+	void *node;
+	uint64_t pos = 0;
 
-				node = parent;
+	while ((node = size_index_next(&this->sizes, &pos)))
+		delete static_cast<node_type *>(node);
 
-				continue;
-			}
-
-			if (node->left)
-			{
-				while (node->left)
-				{
-					node = node->left;
-				}
-			}
-
-			if (node->right)
-			{
-				node = node->right;
-			}
-		}
-	} /* if this->root */
+	size_index_free(&this->sizes);
 }
 
-static fTree *tree;
+static struct dcache *dcache;
 
 static void
 init_openssl(void)
@@ -693,25 +637,28 @@ init_openssl(void)
 #define READ_BLOCK 4096
 
 #define __ALIGN_SIZE(s) (((s) + 0xf) & ~(0xf))
-static char const hexchars[17] = "0123456789abcdef";
 
-gchar *
-get_file_digest(gchar *path)
+/*
+ * Put the digest of the file at PATH into DIGEST (EVP_MAX_MD_SIZE
+ * bytes, zero-padded past the length of the digest in use).
+ */
+static gint
+get_file_digest(gchar *path, unsigned char *digest)
 {
 	struct stat statb;
 	unsigned char *buffer = NULL;
 	gsize toread;
 	ssize_t n;
-	EVP_MD_CTX *ctx;
-	static unsigned char __digest[__ALIGN_SIZE(EVP_MAX_MD_SIZE + 1)];
-	static unsigned char __hex[__ALIGN_SIZE(EVP_MAX_MD_SIZE * 2 + 1)];
+	EVP_MD_CTX *ctx = NULL;
 	guint dlen = 0;
 	gint fd = -1;
 
 	lstat(path, &statb);
 
-	memset(__digest, 0, DIGEST_SIZE / 2);
-	memset(__hex, 0, DIGEST_SIZE);
+	memset(digest, 0, EVP_MAX_MD_SIZE);
+
+	if (dcache && dcache_lookup(dcache, &statb, EVP_MD_type(CTX.digest_func), digest, EVP_MAX_MD_SIZE, &dlen))
+		return 0;
 
 	if ((fd = open(path, O_RDONLY)) < 0)
 	{
@@ -724,7 +671,7 @@ get_file_digest(gchar *path)
 				std::cerr << "Failed to open \"" << path << "\" " << strerror(errno) << std::endl;
 		}
 
-		return NULL;
+		return -1;
 	}
 
 	buffer = (unsigned char *)calloc(__ALIGN_SIZE(statb.st_size+1), 1);
@@ -766,7 +713,7 @@ get_file_digest(gchar *path)
 		toread -= n;
 	}
 
-	if (1 != EVP_DigestFinal_ex(ctx, __digest, &dlen))
+	if (1 != EVP_DigestFinal_ex(ctx, digest, &dlen))
 	{
 		std::cerr << "get_file_digest: failed to finalise hash digest" << std::endl;
 		goto fail;
@@ -775,23 +722,13 @@ get_file_digest(gchar *path)
 	EVP_MD_CTX_destroy(ctx);
 	free(buffer);
 
-	gint i;
-	gint k;
-
-/*
- * Hexlify the digest.
- */
-	for (i = 0, k = 0; i < (gint)dlen; ++i)
-	{
-		__hex[k++] = hexchars[((__digest[i] >> 4) & 0xf)];
-		__hex[k++] = hexchars[(__digest[i] & 0xf)];
-	}
-
-	__hex[k] = 0;
-
 	close(fd);
 	fd = -1;
-	return (gchar *)__hex;
+
+	if (dcache)
+		dcache_store(dcache, &statb, EVP_MD_type(CTX.digest_func), digest, dlen);
+
+	return 0;
 
 	fail:
 
@@ -799,11 +736,12 @@ get_file_digest(gchar *path)
 	fd = -1;
 	free(buffer);
 	EVP_MD_CTX_destroy(ctx);
-	return NULL;
+	return -1;
 }
 
+template <class P>
 static gint
-scan_files(gchar *dir)
+scan_files(fTree<P> *tree, gchar *dir)
 {
 	gsize len = strlen(dir);
 	gchar *p = (dir + len);
@@ -838,7 +776,7 @@ scan_files(gchar *dir)
 
 		if (S_ISDIR(statb.st_mode))
 		{
-			scan_files(dir);
+			scan_files(tree, dir);
 		}
 		else
 		if (S_ISREG(statb.st_mode))
@@ -921,6 +859,16 @@ on_option_select(GtkWidget *widget, gpointer data)
 	return;
 }
 
+/*
+ * Use digest TYPE (an index into plx_digests[]) from now on.
+ */
+static void
+set_digest(gint type)
+{
+	CTX.digest_type = type;
+	CTX.digest_func = (EVP_MD *)plx_digest_md(type);
+}
+
 void
 on_digest_select(GtkWidget *widget, gpointer data)
 {
@@ -944,23 +892,7 @@ on_digest_select(GtkWidget *widget, gpointer data)
 
 		if (dgst_ptr->item == widget)
 		{
-			CTX.digest_type = dgst_ptr->type;
-
-			switch(CTX.digest_type)
-			{
-				case DIGEST_SHA256:
-					CTX.digest_func = (EVP_MD *)EVP_sha256();
-					DIGEST_SIZE = (EVP_MD_size(EVP_sha256()) * 2);
-					break;
-				case DIGEST_SHA512:
-					CTX.digest_func = (EVP_MD *)EVP_sha512();
-					DIGEST_SIZE = (EVP_MD_size(EVP_sha512()) * 2);
-					break;
-				default:
-					CTX.digest_func = (EVP_MD *)EVP_md5();
-					DIGEST_SIZE = (EVP_MD_size(EVP_md5()) * 2);
-			}
-
+			set_digest(dgst_ptr->type);
 			continue;
 		}
 
@@ -1121,32 +1053,20 @@ on_row_toggled(GtkCellRendererToggle *cell, gchar *path, gpointer data)
 	}
 }
 
-void
-on_start_scan(GtkWidget *widget, gpointer data)
+/*
+ * Add the groups of duplicate files found in TREE to the tree store.
+ */
+template <class P>
+static void
+add_results(fTree<P> *tree)
 {
-	if (CTX.scanning == TRUE)
-		return;
-
-	gint retval;
-
-	tree = new fTree();
-
-	CTX.scanning = TRUE;
-	retval = scan_files(CTX.start_at);
-
-	if (retval == -1)
-	{
-		g_error("Scanning failed...");
-		delete tree;
-		return;
-	}
-
 	GtkTreeIter iter;
 	GtkTreeIter child;
 
 	static gchar __size[32];
 	static gchar __created[128];
 	static gchar __modified[128];
+	gchar hex[(P::size << 1) + 1];
 	struct tm tm;
 	struct stat statb;
 
@@ -1154,10 +1074,7 @@ on_start_scan(GtkWidget *widget, gpointer data)
 
 	clear_struct(&statb);
 
-	store = gtk_tree_store_new(NR_COLUMNS, G_TYPE_POINTER, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
-	g_assert(store);
-
-	for (std::map<gchar *,std::list<dNode> >::iterator map_iter = tree->dup_list.begin(); map_iter != tree->dup_list.end(); ++map_iter)
+	for (typename std::vector<dSet<P> >::iterator set_iter = tree->dup_list.begin(); set_iter != tree->dup_list.end(); ++set_iter)
 	{
 		check_button = gtk_check_button_new();
 		g_assert(check_button);
@@ -1166,17 +1083,17 @@ on_start_scan(GtkWidget *widget, gpointer data)
 		gtk_tree_store_set(store, &iter,
 				COL_SELECT, (gpointer)check_button,
 				COL_IS_ALL, TRUE,
-				COL_PATH, map_iter->first,
+				COL_PATH, P::hexlify(set_iter->digest, hex),
 				COL_SIZE, " ",
 				COL_TIME_CREATED, " ",
 				COL_TIME_MODIFIED, " ",
 				-1);
 
-		for (std::list<dNode>::iterator list_iter = map_iter->second.begin(); list_iter != map_iter->second.end(); ++list_iter)
+		for (std::vector<dNode>::iterator file_iter = set_iter->files.begin(); file_iter != set_iter->files.end(); ++file_iter)
 		{
 			clear_struct(&statb);
 
-			lstat(list_iter->name, &statb);
+			lstat(file_iter->name.c_str(), &statb);
 
 			sprintf(__size, "    %lu bytes    ", statb.st_size);
 
@@ -1202,13 +1119,75 @@ on_start_scan(GtkWidget *widget, gpointer data)
 			gtk_tree_store_set(store, &child,
 					COL_SELECT, (gpointer)check_button,
 					COL_IS_ALL, FALSE,
-					COL_PATH, list_iter->name,
+					COL_PATH, file_iter->name.c_str(),
 					COL_SIZE, __size,
 					COL_TIME_CREATED, __created,
 					COL_TIME_MODIFIED, __modified,
 					-1);
 		}
 	}
+}
+
+/*
+ * Scan from CTX.start_at with an index whose digests are
+ * P::size bytes long and add the duplicates to the store.
+ */
+template <class P>
+static gint
+scan_digests(void)
+{
+	fTree<P> *tree = new fTree<P>();
+	gint retval;
+
+	retval = scan_files(tree, CTX.start_at);
+
+	if (retval != -1)
+		add_results(tree);
+
+	delete tree;
+
+	return retval;
+}
+
+void
+on_start_scan(GtkWidget *widget, gpointer data)
+{
+	if (CTX.scanning == TRUE)
+		return;
+
+	gint retval;
+
+	CTX.scanning = TRUE;
+
+	store = gtk_tree_store_new(NR_COLUMNS, G_TYPE_POINTER, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+	g_assert(store);
+
+/*
+ * The length of the digest is settled here, once for the whole
+ * scan; from there on, the index and the map of duplicates only
+ * deal in keys of that fixed width.
+ */
+	switch(plx_digests[CTX.digest_type].size)
+	{
+		case 16:
+			retval = scan_digests<DigestPolicy<16> >();
+			break;
+		case 20:
+			retval = scan_digests<DigestPolicy<20> >();
+			break;
+		case 32:
+			retval = scan_digests<DigestPolicy<32> >();
+			break;
+		default:
+			retval = scan_digests<DigestPolicy<EVP_MAX_MD_SIZE> >();
+	}
+
+	if (retval == -1)
+	{
+		g_error("Scanning failed...");
+		CTX.scanning = FALSE;
+		return;
+	}
 
 	view = gtk_tree_view_new();
 	renderer = gtk_cell_renderer_text_new();
@@ -1252,7 +1231,6 @@ on_start_scan(GtkWidget *widget, gpointer data)
 	gtk_container_add(GTK_CONTAINER(scrolling), view);
 	gtk_container_add(GTK_CONTAINER(results_window), scrolling);
 
-	delete tree;
 	CTX.scanning = FALSE;
 
 	gtk_widget_show_all(results_window);
@@ -1282,9 +1260,15 @@ create_menu_bar(void)
 
 	for (gint i = 0; i < NR_DIGESTS; ++i)
 	{
+		if (!plx_digest_md(i))
+			continue;
+
+		menu_digests[i].type = i;
+		menu_digests[i].name = (const gchar *)plx_digests[i].label;
+		menu_digests[i].func = on_digest_select;
 		menu_digests[i].item = gtk_check_menu_item_new_with_label(menu_digests[i].name);
 
-		if (menu_digests[i].type == __DEFAULT_DIGEST)
+		if (menu_digests[i].type == CTX.digest_type)
 			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menu_digests[i].item), TRUE);
 
 		g_signal_connect(menu_digests[i].item, "toggled", G_CALLBACK(on_digest_select), NULL);
@@ -1453,8 +1437,23 @@ main(int argc, char *argv[])
 
 	init_openssl();
 
-	CTX.digest_func = (EVP_MD *)EVP_md5();
-	DIGEST_SIZE = (EVP_MD_size(EVP_md5()) * 2);
+	/*
+	 * Start with the fastest digest for this
+	 * machine that is strong enough.
+	 */
+	gint type = plx_digest_select(PLX_DIGEST_STRENGTH, EVP_MAX_MD_SIZE, 0);
+
+	set_digest(type < 0 ? plx_digest_index("sha256") : type);
+
+	gchar *cache_path = dcache_default_path();
+
+	if (cache_path)
+	{
+		if (!(dcache = dcache_open(cache_path)))
+			std::cerr << "Not using digest cache " << cache_path << " (" << strerror(errno) << ")" << std::endl;
+
+		free(cache_path);
+	}
 
 	app = gtk_application_new(PROG_NAME_DBUS, G_APPLICATION_FLAGS_NONE);
 	g_signal_connect(app, "activate", G_CALLBACK(create_window), NULL);
@@ -1462,6 +1461,12 @@ main(int argc, char *argv[])
 	g_object_unref(G_OBJECT(app));
 
 	g_list_free(list_digests);
+
+	if (dcache)
+	{
+		dcache_close(dcache);
+		dcache = NULL;
+	}
 #if 0
 	tree = new fTree();
 
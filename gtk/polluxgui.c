@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <openssl/conf.h>
 #include <openssl/err.h>
@@ -11,6 +12,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <gtk/gtk.h>
+#include "../digest.h"
+#include "../digest_cache.h"
+#include "../size_index.h"
 
 #define APPLICATION_NAME "Pollux"
 #define APPLICATION_BUILD "2.0.4"
@@ -36,19 +40,7 @@ static void setup_window(GtkApplication *, gpointer) __nonnull ((1,2));
 static void on_digest_select(GtkWidget *, gpointer) __nonnull((1,2));
 static void on_start_scan(GtkWidget *, gpointer) __nonnull((1));
 
-struct digest_size
-{
-	gsize binary;
-	gsize ascii;
-};
-
-enum
-{
-	DIGEST_MD5 = 0,
-	DIGEST_SHA256,
-	DIGEST_SHA512,
-	NR_DIGESTS
-};
+#define NR_DIGESTS NR_PLX_DIGESTS
 
 enum
 {
@@ -56,15 +48,8 @@ enum
 	NR_COLS_DUPS
 };
 
-#define plx_get_digest_size_binary(type) (digest_sizes[(type)].binary)
-#define plx_get_digest_size_ascii(type) (digest_sizes[(type)].ascii)
-
-struct digest_size digest_sizes[NR_DIGESTS] =
-{
-	{ 16, 32 },
-	{ 32, 64 },
-	{ 64, 128 }
-};
+#define plx_get_digest_size_binary(type) (plx_digests[(type)].size)
+#define plx_get_digest_size_ascii(type) (plx_digests[(type)].size << 1)
 
 struct digest_opt
 {
@@ -74,16 +59,11 @@ struct digest_opt
 	gcallback_t set_digest_func;
 };
 
-static GtkWidget o_md5;
-static GtkWidget o_sha256;
-static GtkWidget o_sha512;
-
-struct digest_opt hash_digests[NR_DIGESTS] =
-{
-	{ &o_md5, DIGEST_MD5, "MD5", on_digest_select },
-	{ &o_sha256, DIGEST_SHA256, "SHA256", on_digest_select },
-	{ &o_sha512, DIGEST_SHA512, "SHA512", on_digest_select }
-};
+/*
+ * Filled in from plx_digests[] when the menu is created; digests
+ * this build of OpenSSL does not have are left without an item.
+ */
+struct digest_opt hash_digests[NR_DIGESTS];
 
 struct file_node
 {
@@ -91,10 +71,14 @@ struct file_node
 	gsize size;
 	guint cookie;
 	gchar *digest;
-	struct file_node *left;
-	struct file_node *right;
-	struct file_node *bucket; /* files with same size but different hash */
+/*
+ * Files with same size but different hash, as a struct of arrays:
+ * the digests are back to back so they are searched in one scan.
+ */
+	gchar **bucket_paths;
+	gchar *bucket_digests;
 	gint nr_bucket;
+	gint bucket_cap;
 };
 
 struct dup_node
@@ -104,70 +88,154 @@ struct dup_node
 	struct dup_node *prev;
 };
 
+/*
+ * Nodes are handed out from pools of DUP_POOL_NODES,
+ * and only ever freed with the whole pool.
+ */
+#define DUP_POOL_NODES 1024
+
+struct dup_pool
+{
+	struct dup_pool *next;
+	gsize used;
+	struct dup_node nodes[DUP_POOL_NODES];
+};
+
+/*
+ * A set of identical files: the first one found with that
+ * digest and all of its duplicates, NR_NODES files of SIZE
+ * bytes in all, so (NR_NODES - 1) * SIZE bytes reclaimable.
+ */
 struct dup_list
 {
 	gchar *digest;
 	struct dup_node *head;
 	struct dup_node *tail;
 	gsize nr_nodes;
-	void (*insert_dnode)(struct dup_list *, struct dup_node *, gchar *);
+	gsize size;
 };
 
+/*
+ * The sets are found by their digest through SLOTS, an open
+ * addressing table of (index + 1) in DUP_LIST that is never
+ * more than half full, hashed by the first bytes of the
+ * digest (see digest.h).
+ */
+#define DUP_INITIAL 1024
+
 struct file_tree
 {
 	struct file_node *root;
 	struct dup_list *dup_list;
 	gsize list_size;
+	gsize list_cap;
+	guint32 *slots;
+	gsize mask;
+	struct dup_pool *pool;
+	void (*insert_dnode)(struct file_tree *, struct dup_node *, gchar *, gsize, gsize);
 };
 
+static gsize
+__digest_hash(gchar *digest)
+{
+	guint64 h;
+
+	memcpy(&h, digest, sizeof(h));
+	return (gsize)h;
+}
+
+/*
+ * The index in TREE->DUP_LIST of the set with DIGEST, or -1.
+ */
 gint
-__get_hash_idx(struct dup_list *, gsize size, gchar *digest, gsize dsize)
+__get_hash_idx(struct file_tree *tree, gchar *digest, gsize dsize)
 {
 	gsize i;
 
-	for (i = 0; i < size; ++i)
+	if (!tree->slots)
+		return -1;
+
+	for (i = (__digest_hash(digest) & tree->mask); tree->slots[i]; i = ((i + 1) & tree->mask))
 	{
-		if (!memcmp(dup_list[i].digest, digest, dsize))
-			return i;
+		if (!memcmp(tree->dup_list[tree->slots[i] - 1].digest, digest, dsize))
+			return (gint)(tree->slots[i] - 1);
 	}
 
 	return -1;
 }
 
-void
-insert_dnode(struct file_tree *tree, struct dup_node *node, gchar *digest)
+/*
+ * Make room for one more set, growing the array and
+ * the table (twice as big, rehashed) as needed.
+ */
+static void
+__grow_dup_lists(struct file_tree *tree)
 {
-	assert(tree);
-
-	gsize dsize = plx_get_digest_size_binary(plx_ctx.digest_type);
-	struct dup_list *list;
+	guint32 *slots;
+	gsize mask;
+	gsize i;
+	gsize k;
 
-	if (!tree->dup_list)
+	if (tree->list_size == tree->list_cap)
 	{
-		tree->dup_list = malloc(sizeof(struct dup_list));
-		tree->list_size = 1;
-
-		list = &tree->dup_list[0];
-		list->head = node;
-		list->tail = node;
-		node->prev = NULL;
-		list->nr_nodes = 1;
+		tree->list_cap = (tree->list_cap ? (tree->list_cap << 1) : DUP_INITIAL);
+		tree->dup_list = realloc(tree->dup_list, tree->list_cap * sizeof(struct dup_list));
+		assert(tree->dup_list);
+	}
 
+	if (tree->slots && ((tree->list_size + 1) << 1) <= (tree->mask + 1))
 		return;
+
+	mask = (tree->slots ? ((tree->mask << 1) | 1) : ((DUP_INITIAL << 1) - 1));
+	slots = calloc(mask + 1, sizeof(guint32));
+	assert(slots);
+
+	for (i = 0; i < tree->list_size; ++i)
+	{
+		for (k = (__digest_hash(tree->dup_list[i].digest) & mask); slots[k]; k = ((k + 1) & mask))
+			;
+
+		slots[k] = (guint32)(i + 1);
 	}
 
+	free(tree->slots);
+	tree->slots = slots;
+	tree->mask = mask;
+
+	return;
+}
+
 /*
- * Terrible (O(N)), but for the time-being until I can be bothered
- * creating a hash bucket implementation, this is what will be
- * used.
+ * Add NODE to the set of files with DIGEST (of DSIZE bytes),
+ * making the set, for files of SIZE bytes, if there is none.
  */
-	if ((idx = __get_hash_idx(tree->dup_list, tree->list_size, digest, dsize)) == -1)
+void
+insert_dnode(struct file_tree *tree, struct dup_node *node, gchar *digest, gsize dsize, gsize size)
+{
+	assert(tree);
+
+	struct dup_list *list;
+	gint idx;
+	gsize k;
+
+	node->next = NULL;
+	node->prev = NULL;
+
+	if ((idx = __get_hash_idx(tree, digest, dsize)) == -1)
 	{
-		++tree->list_size;
-		tree->dup_list = realloc(tree->dup_list, (tree->list_size * sizeof(struct dup_node)));
-		assert(tree->dup_list);
+		__grow_dup_lists(tree);
+
+		list = &tree->dup_list[tree->list_size++];
+		memset(list, 0, sizeof(*list));
+		list->digest = malloc(dsize);
+		assert(list->digest);
+		memcpy(list->digest, digest, dsize);
+		list->size = size;
 
-		list = &tree->dup_list[tree->list_size - 1];
+		for (k = (__digest_hash(digest) & tree->mask); tree->slots[k]; k = ((k + 1) & tree->mask))
+			;
+
+		tree->slots[k] = (guint32)tree->list_size;
 	}
 	else
 	{
@@ -233,20 +301,18 @@ struct pollux_ctx
 };
 
 struct pollux_ctx plx_ctx = {0};
-struct file_node *root = NULL;
 
-static void
-plx_dup_digest(gchar **target, gchar *digest, gsize size)
-{
-	assert(target);
-	assert(digest);
-
-	(*target) = calloc(PLX_ALIGN_SIZE(size), 1);
-	memcpy((*target), digest, size);
-	(*target)[size] = 0;
+/*
+ * The first file of each size, keyed by the size;
+ * the others of that size are in its bucket.
+ */
+static struct size_index sizes;
 
-	return;
-}
+/*
+ * Digests of unchanged files are reused from
+ * one scan (and one run) to the next.
+ */
+static struct dcache *dcache = NULL;
 
 const char const hexchars[16] = "0123456789abcdef";
 
@@ -269,12 +335,68 @@ plx_get_digest_ascii(gchar *ascii, gchar *binary, gsize size)
 	return;
 }
 
+static struct dup_node *
+plx_new_dnode(struct file_tree *tree, gchar *path)
+{
+	struct dup_pool *pool = tree->pool;
+	struct dup_node *node;
+
+	if (!pool || pool->used == DUP_POOL_NODES)
+	{
+		pool = malloc(sizeof(struct dup_pool));
+		assert(pool);
+
+		pool->next = tree->pool;
+		pool->used = 0;
+		tree->pool = pool;
+	}
+
+	node = &pool->nodes[pool->used++];
+	node->path = strdup(path);
+	assert(node->path);
+
+	return node;
+}
+
+/*
+ * Add DUP to the set of files with DIGEST, which starts with
+ * KEEP (the file DUP was found to be the same as) if DUP is
+ * the first duplicate of it.
+ */
 static void
-plx_dup_add_pair(struct pollux_ctx *ctx, gchar *first, gchar *second, gchar *digest)
+plx_dup_add(struct pollux_ctx *ctx, gchar *keep, gchar *dup, gchar *digest, gsize size)
 {
 	g_return_if_fail(ctx != NULL);
-	g_return_if_fail(first != NULL);
-	g_return_if_fail(second != NULL);
+	g_return_if_fail(keep != NULL);
+	g_return_if_fail(dup != NULL);
+
+	struct file_tree *tree = ctx->_tree;
+	gsize dsize = plx_get_digest_size_binary(ctx->digest_type);
+
+	if (__get_hash_idx(tree, digest, dsize) == -1)
+		tree->insert_dnode(tree, plx_new_dnode(tree, keep), digest, dsize, size);
+
+	tree->insert_dnode(tree, plx_new_dnode(tree, dup), digest, dsize, size);
+
+	return;
+}
+
+/*
+ * One row for each set of identical files, with its
+ * files below it.
+ */
+static void
+plx_fill_dup_store(struct pollux_ctx *ctx)
+{
+	struct file_tree *tree = ctx->_tree;
+	struct dup_list *list;
+	struct dup_node *node;
+	GtkTreeIter iter;
+	GtkTreeIter child;
+	gsize binary_size = plx_get_digest_size_binary(ctx->digest_type);
+	gchar digest_ascii[DIGEST_ASCII_MAX_SIZE + 1];
+	gchar row[DIGEST_ASCII_MAX_SIZE + 64];
+	gsize i;
 
 	if (!ctx->tree.initialised)
 	{
@@ -283,19 +405,59 @@ plx_dup_add_pair(struct pollux_ctx *ctx, gchar *first, gchar *second, gchar *dig
 	}
 
 	GtkTreeStore *store = GTK_TREE_STORE(ctx->tree.store);
-	GtkTreeIter iter;
-	GtkTreeIter child;
-	gsize binary_size = plx_get_digest_size_binary(ctx->digest_type);
-	static gchar digest_ascii[DIGEST_ASCII_MAX_SIZE];
 
-	plx_get_digest_ascii(digest_ascii, digest, binary_size);
+	for (i = 0; tree->dup_list && i < tree->list_size; ++i)
+	{
+		list = &tree->dup_list[i];
+
+		plx_get_digest_ascii(digest_ascii, list->digest, binary_size);
+		snprintf(row, sizeof(row), "%s (%lu files, %lu B reclaimable)",
+			digest_ascii,
+			(unsigned long)list->nr_nodes,
+			(unsigned long)((list->nr_nodes - 1) * list->size));
+
+		gtk_tree_store_append(store, &iter, NULL);
+		gtk_tree_store_set(store, &iter, COL_FILE_DIGEST, row, -1);
 
-	gtk_tree_store_append(store, &iter, NULL);
-	gtk_tree_store_set(store, &iter, COL_FILE_DIGEST, digest_ascii, -1);
-	gtk_tree_store_append(store, &child, &iter);
-	gtk_tree_store_set(store, &child, 0, first, -1);
-	gtk_tree_store_append(store, &child, &iter);
-	gtk_tree_store_set(store, &child, 0, second, -1);
+		for (node = list->head; node; node = node->next)
+		{
+			gtk_tree_store_append(store, &child, &iter);
+			gtk_tree_store_set(store, &child, 0, node->path, -1);
+		}
+	}
+
+	return;
+}
+
+static void
+plx_destroy_dups(struct file_tree *tree)
+{
+	struct dup_pool *pool;
+	struct dup_pool *next;
+	gsize i;
+
+	for (i = 0; i < tree->list_size; ++i)
+		free(tree->dup_list[i].digest);
+
+	for (pool = tree->pool; pool; pool = next)
+	{
+		next = pool->next;
+
+		for (i = 0; i < pool->used; ++i)
+			free(pool->nodes[i].path);
+
+		free(pool);
+	}
+
+	free(tree->dup_list);
+	free(tree->slots);
+
+	tree->dup_list = NULL;
+	tree->list_size = 0;
+	tree->list_cap = 0;
+	tree->slots = NULL;
+	tree->mask = 0;
+	tree->pool = NULL;
 
 	return;
 }
@@ -312,36 +474,31 @@ plx_get_file_digest(gchar **digest, gchar *filename)
 	gsize toread = 0;
 	gssize bytes = 0;
 	gchar block[READ_BLOCK+16];
+	const EVP_MD *md;
 
 	clear_struct(&statb);
 
 	if (lstat(filename, &statb) < 0)
 		goto fail;
 
+	if (!(md = plx_digest_md(plx_ctx.digest_type)))
+		goto fail;
+
+	if (!(*digest = calloc(PLX_ALIGN_SIZE(plx_get_digest_size_binary(plx_ctx.digest_type)+17), 1)))
+		goto fail;
+
+	if (dcache && dcache_lookup(dcache, &statb, EVP_MD_type(md), (unsigned char *)(*digest),
+			plx_get_digest_size_binary(plx_ctx.digest_type), &len))
+		return 0;
+
 	if ((fd = open(filename, O_RDONLY)) < 0)
 		goto fail;
 
 	if (!(ctx = EVP_MD_CTX_create()))
 		goto fail;
 
-	switch(plx_ctx.digest_type)
-	{
-		case DIGEST_SHA256:
-			g_print("using sha256\n");
-			if (1 != EVP_DigestInit_ex(ctx, EVP_sha256(), NULL))
-				goto fail;
-			break;
-		case DIGEST_SHA512:
-			g_print("using sha512\n");
-			if (1 != EVP_DigestInit_ex(ctx, EVP_sha512(), NULL))
-				goto fail;
-			break;
-		default:
-			g_print("using md5\n");
-			if (1 != EVP_DigestInit_ex(ctx, EVP_md5(), NULL))
-				goto fail;
-			break;
-	}
+	if (1 != EVP_DigestInit_ex(ctx, md, NULL))
+		goto fail;
 
 	toread = statb.st_size;
 
@@ -361,12 +518,14 @@ plx_get_file_digest(gchar **digest, gchar *filename)
 		toread -= bytes;
 	}
 
-	*digest = calloc(PLX_ALIGN_SIZE(plx_get_digest_size_binary(plx_ctx.digest_type)+17), 1);
 	if (1 != EVP_DigestFinal_ex(ctx, (unsigned char *)(*digest), &len))
 		goto fail;
 
 	g_assert(len == plx_get_digest_size_binary(plx_ctx.digest_type));
 
+	if (dcache)
+		dcache_store(dcache, &statb, EVP_MD_type(md), (unsigned char *)(*digest), len);
+
 	//(*digest)[len] = 0;
 
 	close(fd);
@@ -386,26 +545,32 @@ plx_get_file_digest(gchar **digest, gchar *filename)
 		ctx = NULL;
 	}
 
+	/* never leave a digest behind that could match another */
+	free(*digest);
+	*digest = NULL;
+
 	return -1;
 }
 
 static gchar *
 plx_digest_name_str(gint type)
 {
-	switch(type)
-	{
-		case DIGEST_SHA256:
-			return "SHA256";
-			break;
-		case DIGEST_SHA512:
-			return "SHA512";
-			break;
-		default:
-			return "MD5";
-			break;
-	}
+	return (gchar *)plx_digests[type].label;
+}
+
+/*
+ * The fastest digest for this machine that is strong enough,
+ * or SHA256 if, somehow, none of them is available.
+ */
+static gint
+plx_default_digest(void)
+{
+	gint type = plx_digest_select(PLX_DIGEST_STRENGTH, EVP_MAX_MD_SIZE, 0);
+
+	if (type < 0)
+		type = plx_digest_index("sha256");
 
-	return NULL;
+	return type;
 }
 
 static void
@@ -422,227 +587,137 @@ plx_print_digest(gchar *digest)
 static gint
 __insert_file_node(gchar *path, gsize size)
 {
-	if (!root)
+	struct file_node **slot = (struct file_node **)size_index_get(&sizes, (uint64_t)size, 1);
+
+	assert(slot);
+
+	if (!*slot)
 	{
-		root = malloc(sizeof(struct file_node));
+		*slot = malloc(sizeof(struct file_node));
 
-		assert(root);
+		assert(*slot);
 
-		root->left = NULL;
-		root->right = NULL;
-		root->bucket = NULL;
-		root->digest = NULL;
+		(*slot)->bucket_paths = NULL;
+		(*slot)->bucket_digests = NULL;
+		(*slot)->nr_bucket = 0;
+		(*slot)->bucket_cap = 0;
+		(*slot)->digest = NULL;
 
-		root->cookie = FILE_NODE_COOKIE;
+		(*slot)->cookie = FILE_NODE_COOKIE;
 
-		root->path = strdup(path);
-		assert(root->path);
-		root->size = size;
+		(*slot)->path = strdup(path);
+		assert((*slot)->path);
+		(*slot)->size = size;
 
 		return 0;
 	}
 
-	g_assert(root);
-	g_assert(root->cookie == FILE_NODE_COOKIE);
-
-	if (root->left && root->right)
-		g_assert(root->left != root->right);
-
 	gchar *current_digest = NULL;
-	struct file_node *nptr = root;
-
-	while (1)
-	{
-		if (size < nptr->size)
-		{
-			if (!nptr->left)
-			{
-				nptr->left = malloc(sizeof(struct file_node));
-				assert(nptr->left);
-
-				nptr->left->left = NULL;
-				nptr->left->right = NULL;
-				nptr->left->bucket = NULL;
-				nptr->left->digest = NULL;
-
-				nptr->left->cookie = FILE_NODE_COOKIE;
-
-				nptr->left->path = strdup(path);
-				assert(nptr->left->path);
-				nptr->left->size = size;
-
-				break;
-			}
-			else
-			{
-				nptr = nptr->left;
-				continue;
-			}
-		}
-		else
-		if (size > nptr->size)
-		{
-			if (!nptr->right)
-			{
-				nptr->right = malloc(sizeof(struct file_node));
-				assert(nptr->right);
+	struct file_node *nptr = *slot;
 
-				nptr->right->left = NULL;
-				nptr->right->right = NULL;
-				nptr->right->bucket = NULL;
-				nptr->right->digest = NULL;
+	g_assert(nptr->cookie == FILE_NODE_COOKIE);
 
-				nptr->right->cookie = FILE_NODE_COOKIE;
-
-				nptr->right->path = strdup(path);
-				assert(nptr->right->path);
-				nptr->right->size = size;
-
-				break;
-			}
-			else
-			{
-				nptr = nptr->right;
-				continue;
-			}
-		}
-		else
-		{
 /*
  * Only calculate hash digests when we have a
  * collision of sizes.
  */
-			gsize digest_size = plx_get_digest_size_binary(plx_ctx.digest_type);
+	gsize digest_size = plx_get_digest_size_binary(plx_ctx.digest_type);
 
-			if (!nptr->digest)
-			{
-				plx_get_file_digest(&nptr->digest, nptr->path);
-				g_assert(nptr->cookie == FILE_NODE_COOKIE);
-			}
+/*
+ * A file we cannot hash cannot be matched against,
+ * so it is passed over.
+ */
+	if (!nptr->digest)
+	{
+		if (plx_get_file_digest(&nptr->digest, nptr->path) < 0)
+			return 0;
+
+		g_assert(nptr->cookie == FILE_NODE_COOKIE);
+	}
 
-			plx_get_file_digest(&current_digest, path);
+	if (plx_get_file_digest(&current_digest, path) < 0)
+		return 0;
 
-			plx_print_digest(current_digest);
-			plx_print_digest(nptr->digest);
+	plx_print_digest(current_digest);
+	plx_print_digest(nptr->digest);
 
-			if (!memcmp(current_digest, nptr->digest, digest_size))
-			{
-				PLX_INC_DUPS(&plx_ctx);
-				PLX_ADD_MEM(&plx_ctx, size);
-				struct dup_node *node = malloc(sizeof(struct dup_node));
-				plx_ctx._tree->insert_dnode(plx_ctx._tree, node, current_digest);
-				plx_dup_add_pair(&plx_ctx, nptr->path, path, nptr->digest);
-				free(current_digest);
-				break;
-			}
-			else
-			{
+	if (!memcmp(current_digest, nptr->digest, digest_size))
+	{
+		PLX_INC_DUPS(&plx_ctx);
+		PLX_ADD_MEM(&plx_ctx, size);
+		plx_dup_add(&plx_ctx, nptr->path, path, nptr->digest, size);
+		free(current_digest);
+		return 0;
+	}
+	else
+	{
 /*
  * Files that have the same size but different hash digests
- * are saved in the BUCKET member of the node with that size.
+ * are saved in the bucket of the node with that size, which
+ * doubles when it is full.
  */
-				if (!nptr->bucket)
-				{
-					nptr->nr_bucket = 1;
-					nptr->bucket = calloc(nptr->nr_bucket, PLX_ALIGN_SIZE(digest_size + 1));
+		gint bi = -1;
 
-					nptr->bucket[nptr->nr_bucket - 1].digest = calloc(PLX_ALIGN_SIZE(digest_size + 1), 1);
-					plx_dup_digest(&nptr->bucket[nptr->nr_bucket - 1].digest, current_digest, digest_size);
-#if 0
-					memcpy(nptr->bucket[nptr->nr_bucket - 1].digest, current_digest, digest_size);
-					nptr->bucket[nptr->nr_bucket - 1].digest[digest_size] = 0;
-#endif
-					nptr->bucket[nptr->nr_bucket - 1].path = strdup(path);
-					nptr->bucket[nptr->nr_bucket - 1].size = size;
-				}
-				else
-				{
-					gint bi;
-					gint nr_dups = plx_ctx.nr_duplicates;
-
-					for (bi = 0; bi < (nptr->nr_bucket - 1); bi += 2)
-					{
-						if (!memcmp(current_digest, nptr->bucket[bi].digest, digest_size))
-						{
-							PLX_INC_DUPS(&plx_ctx);
-							PLX_ADD_MEM(&plx_ctx, size);
-							plx_dup_add_pair(&plx_ctx, nptr->bucket[bi].path, path, nptr->bucket[bi].digest);
-						}
-						else
-						if (!memcmp(current_digest, nptr->bucket[bi+1].digest, digest_size))
-						{
-							PLX_INC_DUPS(&plx_ctx);
-							PLX_ADD_MEM(&plx_ctx, size);
-							plx_dup_add_pair(&plx_ctx, nptr->bucket[bi+1].path, path, nptr->bucket[bi+1].digest);
-						}
-					}
-
-					if (nptr->nr_bucket & 1)
-					{
-						if (!memcmp(current_digest, nptr->bucket[bi].digest, digest_size))
-						{
-							PLX_INC_DUPS(&plx_ctx);
-							PLX_ADD_MEM(&plx_ctx, size);
-							plx_dup_add_pair(&plx_ctx, nptr->bucket[bi].path, path, nptr->bucket[bi].digest);
-						}
-					}
-
-					if (nr_dups == plx_ctx.nr_duplicates)
-					{
-						++nptr->nr_bucket;
-						nptr->bucket = realloc(nptr->bucket, PLX_ALIGN_SIZE((nptr->nr_bucket * sizeof(struct file_node))));
-
-						nptr->bucket[nptr->nr_bucket - 1].digest = calloc(PLX_ALIGN_SIZE(digest_size+1), 1);
-						plx_dup_digest(&nptr->bucket[nptr->nr_bucket - 1].digest, current_digest, digest_size);
-#if 0
-						memcpy(nptr->bucket[nptr->nr_bucket - 1].digest, current_digest, digest_size);
-						nptr->bucket[nptr->nr_bucket - 1].digest[digest_size] = 0;
-#endif
-						nptr->bucket[nptr->nr_bucket - 1].path = strdup(path);
-						nptr->bucket[nptr->nr_bucket - 1].size = size;
-					}
-				} /* else nptr->bucket */
-			} /* else memcmp(...) */
+		if (nptr->nr_bucket)
+			bi = (gint)plx_digest_find((unsigned char *)nptr->bucket_digests, nptr->nr_bucket,
+					digest_size, (unsigned char *)current_digest);
 
-			if (current_digest)
-				free(current_digest);
+		if (bi >= 0)
+		{
+			PLX_INC_DUPS(&plx_ctx);
+			PLX_ADD_MEM(&plx_ctx, size);
+			plx_dup_add(&plx_ctx, nptr->bucket_paths[bi], path, nptr->bucket_digests + (bi * digest_size), size);
+		}
+		else
+		{
+			if (nptr->nr_bucket == nptr->bucket_cap)
+			{
+				nptr->bucket_cap = (nptr->bucket_cap ? (nptr->bucket_cap << 1) : 4);
+				nptr->bucket_paths = realloc(nptr->bucket_paths, nptr->bucket_cap * sizeof(gchar *));
+				nptr->bucket_digests = realloc(nptr->bucket_digests, nptr->bucket_cap * digest_size);
 
-			break;
+				assert(nptr->bucket_paths);
+				assert(nptr->bucket_digests);
+			}
 
-		} /* else size == nptr->size */
-	} /* while (1) */
+			memcpy(nptr->bucket_digests + (nptr->nr_bucket * digest_size), current_digest, digest_size);
+			nptr->bucket_paths[nptr->nr_bucket] = strdup(path);
+			assert(nptr->bucket_paths[nptr->nr_bucket]);
+			++nptr->nr_bucket;
+		}
+	} /* else memcmp(...) */
+
+	if (current_digest)
+		free(current_digest);
 
 	return 0;
 }
 
 static void
-plx_destroy_tree(struct file_node **node)
+plx_destroy_tree(void)
 {
-	if ((*node)->left)
-		plx_destroy_tree(&(*node)->left);
-
-	if ((*node)->right)
-		plx_destroy_tree(&(*node)->right);
-
-	free((*node)->path);
-	(*node)->path = NULL;
-
-	if ((*node)->bucket)
-	{
-		free((*node)->bucket);
-		(*node)->bucket = NULL;
-	}
+	struct file_node *node;
+	uint64_t pos = 0;
+	gint i;
 
-	if ((*node)->digest)
+	while ((node = size_index_next(&sizes, &pos)))
 	{
-		free((*node)->digest);
-		(*node)->digest = NULL;
+		for (i = 0; i < node->nr_bucket; ++i)
+			free(node->bucket_paths[i]);
+
+		free(node->bucket_paths);
+		free(node->bucket_digests);
+		free(node->path);
+		free(node->digest);
+		free(node);
 	}
 
-	(*node)->size = 0;
+/*
+ * Ready for the next scan.
+ */
+	size_index_free(&sizes);
+	size_index_init(&sizes);
 
-	free(*node);
-	*node = NULL;
 	return;
 }
 
@@ -737,6 +812,7 @@ plx_show_duplicate_files(struct pollux_ctx *ctx)
 	sprintf(col_name, "%d duplicates [%s digest]", plx_ctx.nr_duplicates, plx_digest_name_str(plx_ctx.digest_type));
 	gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, col_name, renderer, "text", 0, NULL);
 
+	plx_fill_dup_store(ctx);
 	store = ctx->tree.store;
 	gtk_tree_view_set_model(GTK_TREE_VIEW(view), GTK_TREE_MODEL(store));
 	g_object_unref(store);
@@ -768,7 +844,8 @@ plx_show_duplicate_files(struct pollux_ctx *ctx)
 	gtk_grid_attach(GTK_GRID(grid), view, 0, 2, 1, 1);
 	gtk_container_add(GTK_CONTAINER(window), grid);
 
-	plx_destroy_tree(&root);
+	plx_destroy_tree();
+	plx_destroy_dups(ctx->_tree);
 	gtk_widget_show_all(window);
 
 	return;
@@ -797,14 +874,33 @@ __attribute__((constructor)) __plx_init(void)
 		goto fail;
 	}
 
+	if (size_index_init(&sizes) < 0)
+	{
+		g_error("Failed to allocate the size index\n");
+		goto fail;
+	}
+
 	plx_ctx.scanning = 0;
 	plx_ctx.gui.digests = hash_digests;
-	plx_ctx.digest_type = DIGEST_MD5;
+	plx_ctx.digest_type = plx_default_digest();
+
+	gchar *cache_path = dcache_default_path();
+
+	if (cache_path)
+	{
+		if (!(dcache = dcache_open(cache_path)))
+			g_print("Not using digest cache %s (%s)\n", cache_path, strerror(errno));
+
+		free(cache_path);
+	}
+
+	plx_ctx._tree = calloc(1, sizeof(struct file_tree));
+	if (!plx_ctx._tree)
+	{
+		g_error("Failed to allocate the duplicate sets\n");
+		goto fail;
+	}
 
-	plx_ctx._tree = malloc(sizeof(struct file_tree));
-	plx_ctx._tree->head = NULL;
-	plx_ctx._tree->tail = NULL;
-	plx_ctx._tree->digest = NULL;
 	plx_ctx._tree->insert_dnode = insert_dnode;
 
 	return;
@@ -822,33 +918,17 @@ __attribute__((destructor)) __plx_fini(void)
 		path_buf = NULL;
 	}
 
-	if (plx_ctx._tree)
+	if (dcache)
 	{
-		if (plx_ctx._tree->dup_list)
-		{
-			gint nr = plx_ctx._tree->list_size;
-			gint i;
-			struct dup_list *list;
-			struct dup_node *node;
-			struct dup_node *prev;
-
-			for (i = 0; i < nr; ++i)
-			{
-				list = &plx_ctx._tree->dup_list[i];
-
-				if (list->digest)
-					free(list->digest);
-
-				node = list->head;
+		dcache_close(dcache);
+		dcache = NULL;
+	}
 
-				while (node)
-				{
-					prev = node;
-					node = node->next;
-					free(prev);
-				}
-			}
-		}
+	if (plx_ctx._tree)
+	{
+		plx_destroy_dups(plx_ctx._tree);
+		free(plx_ctx._tree);
+		plx_ctx._tree = NULL;
 	}
 
 	return;
@@ -910,7 +990,7 @@ on_digest_select(GtkWidget *widget, gpointer type)
 
 	for (i = 0; i < NR_DIGESTS; ++i)
 	{
-		if (digests[i].menu_item == widget)
+		if (!digests[i].menu_item || digests[i].menu_item == widget)
 			continue;
 
 		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(digests[i].menu_item), FALSE);
@@ -1063,8 +1143,9 @@ window_add_menus(struct pollux_ctx *ctx)
  * [Options]
  * [digests>
  *          [MD5
+ *          [SHA1
  *          [SHA256
- *          [SHA512
+ *          ...
  */
 	gtk_menu_item_set_submenu(GTK_MENU_ITEM(mbi_options), options_menu);
 	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), smi_digests);
@@ -1072,12 +1153,18 @@ window_add_menus(struct pollux_ctx *ctx)
 
 	for (i = 0; i < NR_DIGESTS; ++i)
 	{
+		if (!plx_digest_md(i))
+			continue;
+
+		hash_digests[i].type = i;
+		hash_digests[i].name = (gchar *)plx_digests[i].label;
+		hash_digests[i].set_digest_func = on_digest_select;
 		hash_digests[i].menu_item = gtk_check_menu_item_new_with_label(hash_digests[i].name);
 
 /*
- * Set MD5 as default.
+ * Tick the digest chosen at startup.
  */
-		if (hash_digests[i].type == DIGEST_MD5)
+		if (hash_digests[i].type == plx_ctx.digest_type)
 			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(hash_digests[i].menu_item), TRUE);
 
 		g_signal_connect(G_OBJECT(hash_digests[i].menu_item), "toggled", G_CALLBACK(on_digest_select), (gpointer)&hash_digests[i].type);
@@ -1173,7 +1260,7 @@ main(int argc, char *argv[])
 	 */
 	//gtk_init(&argc, &argv);
 
-	plx_ctx.digest_type = DIGEST_MD5;
+	plx_ctx.digest_type = plx_default_digest();
 	app = gtk_application_new("org.pollux", G_APPLICATION_FLAGS_NONE);
 	g_signal_connect(app, "activate", G_CALLBACK(setup_window), NULL);
 	// do not make the mistake of using the GTK_APPLICATION() macro
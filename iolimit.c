@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "iolimit.h"
+
+#ifndef IOPRIO_CLASS_IDLE
+# define IOPRIO_CLASS_SHIFT	13
+# define IOPRIO_CLASS_IDLE	3
+# define IOPRIO_WHO_PROCESS	1
+#endif
+
+struct plx_iolimit plx_io = { .duty = 1.0 };
+
+int64_t
+plx_io_now(void)
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((int64_t)ts.tv_sec * 1000000000L) + ts.tv_nsec);
+}
+
+static void
+nap(int64_t ns)
+{
+	struct timespec		ts;
+
+	if (ns <= 0)
+		return;
+
+	ts.tv_sec = (ns / 1000000000L);
+	ts.tv_nsec = (ns % 1000000000L);
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+
+	plx_io.waited_ns += ns;
+}
+
+/*
+ * Limit reads to BPS bytes and IOPS reads per second (0 for no limit),
+ * and back off when their latency rises if ADAPTIVE is set.
+ */
+void
+plx_io_setup(uint64_t bps, uint64_t iops, int adaptive)
+{
+	plx_io.bps = bps;
+	plx_io.iops = iops;
+	plx_io.adaptive = adaptive;
+	plx_io.active = (bps || iops || adaptive);
+	plx_io.duty = 1.0;
+	plx_io.last_ns = plx_io_now();
+	plx_io.adjust_ns = plx_io.last_ns;
+
+	/* start with a full burst */
+	plx_io.byte_tokens = ((double)bps * PLX_IO_BURST_NSEC) / 1e9;
+	plx_io.op_tokens = ((double)iops * PLX_IO_BURST_NSEC) / 1e9;
+}
+
+/*
+ * Put the process in the idle I/O scheduling class: its reads are
+ * only served when no one else wants the disk.
+ */
+int
+plx_io_idle(void)
+{
+#ifdef SYS_ioprio_set
+	return (int)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Parse a rate such as "512K" or "20M" (powers of 1024) into *RATE.
+ */
+int
+plx_io_parse_rate(const char *s, uint64_t *rate)
+{
+	char			*end = NULL;
+	unsigned long long	n;
+
+	errno = 0;
+	n = strtoull(s, &end, 10);
+
+	if (errno || end == s)
+		return -1;
+
+	switch (*end)
+	{
+		case 'g': case 'G':
+			n <<= 10;
+			/* fall through */
+		case 'm': case 'M':
+			n <<= 10;
+			/* fall through */
+		case 'k': case 'K':
+			n <<= 10;
+			++end;
+			break;
+	}
+
+	if (*end)
+		return -1;
+
+	*rate = (uint64_t)n;
+	return 0;
+}
+
+/*
+ * Wait until the buckets hold enough tokens for a read of BYTES bytes.
+ */
+void
+plx_io_wait(size_t bytes)
+{
+	double		cap;
+	int64_t		now, need = 0, ns;
+
+	if (!plx_io.bps && !plx_io.iops)
+		return;
+
+	now = plx_io_now();
+	ns = (now - plx_io.last_ns);
+	plx_io.last_ns = now;
+
+	if (plx_io.bps)
+	{
+		cap = ((double)plx_io.bps * PLX_IO_BURST_NSEC) / 1e9;
+		if (cap < (double)bytes)
+			cap = (double)bytes;
+
+		plx_io.byte_tokens += ((double)plx_io.bps * ns) / 1e9;
+		if (plx_io.byte_tokens > cap)
+			plx_io.byte_tokens = cap;
+
+		if (plx_io.byte_tokens < (double)bytes)
+			need = (int64_t)((((double)bytes - plx_io.byte_tokens) * 1e9) / plx_io.bps);
+	}
+
+	if (plx_io.iops)
+	{
+		cap = ((double)plx_io.iops * PLX_IO_BURST_NSEC) / 1e9;
+		if (cap < 1.0)
+			cap = 1.0;
+
+		plx_io.op_tokens += ((double)plx_io.iops * ns) / 1e9;
+		if (plx_io.op_tokens > cap)
+			plx_io.op_tokens = cap;
+
+		if (plx_io.op_tokens < 1.0 && (ns = (int64_t)(((1.0 - plx_io.op_tokens) * 1e9) / plx_io.iops)) > need)
+			need = ns;
+	}
+
+	/* the tokens that come in while we sleep pay for this read */
+	if (need > 0)
+	{
+		nap(need);
+		plx_io.last_ns += need;
+		plx_io.byte_tokens += ((double)plx_io.bps * need) / 1e9;
+		plx_io.op_tokens += ((double)plx_io.iops * need) / 1e9;
+	}
+
+	if (plx_io.bps)
+		plx_io.byte_tokens -= (double)bytes;
+	if (plx_io.iops)
+		plx_io.op_tokens -= 1.0;
+}
+
+/*
+ * Account for a read that took NS nanoseconds; in adaptive mode, adjust
+ * the duty cycle to the latency and sleep for the idle part of it.
+ */
+void
+plx_io_done(int64_t ns)
+{
+	int64_t		now;
+
+	if (!plx_io.adaptive)
+		return;
+
+	if (plx_io.lat_ewma == 0.0)
+		plx_io.lat_ewma = (double)ns;
+	else
+		plx_io.lat_ewma += ((double)ns - plx_io.lat_ewma) / 16;
+
+	/*
+	 * The lowest latency seen is what an idle disk gives; let it
+	 * drift up slowly so that a single lucky read does not count
+	 * for ever.
+	 */
+	if (plx_io.lat_base == 0.0 || plx_io.lat_ewma < plx_io.lat_base)
+		plx_io.lat_base = plx_io.lat_ewma;
+	else
+		plx_io.lat_base += (plx_io.lat_ewma - plx_io.lat_base) / 4096;
+
+	now = plx_io_now();
+
+	if ((now - plx_io.adjust_ns) >= PLX_IO_ADJUST_NSEC)
+	{
+		if (plx_io.lat_ewma > (plx_io.lat_base * PLX_IO_LAT_HIGH))
+		{
+			if (plx_io.duty > PLX_IO_DUTY_MIN)
+			{
+				plx_io.duty /= 2;
+				++plx_io.backoffs;
+			}
+		}
+		else
+		if (plx_io.lat_ewma < (plx_io.lat_base * PLX_IO_LAT_LOW) && plx_io.duty < 1.0)
+		{
+			plx_io.duty *= 1.25;
+			if (plx_io.duty > 1.0)
+				plx_io.duty = 1.0;
+		}
+
+		plx_io.adjust_ns = now;
+	}
+
+	if (plx_io.duty < 1.0)
+		nap((int64_t)((double)ns * ((1.0 / plx_io.duty) - 1.0)));
+}
+
+ssize_t
+plx_pread(int fd, void *buf, size_t count, off_t off)
+{
+	ssize_t		n;
+	int64_t		t0;
+
+	if (!plx_io.active)
+		return pread(fd, buf, count, off);
+
+	plx_io_wait(count);
+	t0 = plx_io_now();
+	n = pread(fd, buf, count, off);
+	plx_io_done(plx_io_now() - t0);
+
+	return n;
+}
+
+ssize_t
+plx_read(int fd, void *buf, size_t count)
+{
+	ssize_t		n;
+	int64_t		t0;
+
+	if (!plx_io.active)
+		return read(fd, buf, count);
+
+	plx_io_wait(count);
+	t0 = plx_io_now();
+	n = read(fd, buf, count);
+	plx_io_done(plx_io_now() - t0);
+
+	return n;
+}
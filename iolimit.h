@@ -0,0 +1,61 @@
+#ifndef IOLIMIT_H
+#define IOLIMIT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Throttling of the reads done to compare and hash files, so that a scan
+ * can run next to production traffic.
+ *
+ * Bytes and reads per second are each limited by a token bucket that can
+ * hold PLX_IO_BURST_NSEC worth of tokens. In adaptive mode, the latency of
+ * the reads is tracked as well: when it climbs well above the lowest seen,
+ * the scan halves its duty cycle (sleeping in proportion to the time each
+ * read took), and it speeds up again as the latency comes back down.
+ */
+
+#define PLX_IO_BURST_NSEC	100000000L /* 0.1 s */
+#define PLX_IO_ADJUST_NSEC	100000000L /* how often the duty cycle may change */
+#define PLX_IO_LAT_HIGH		2.0	/* back off above this times the lowest latency */
+#define PLX_IO_LAT_LOW		1.25	/* speed up below this */
+#define PLX_IO_DUTY_MIN		(1.0 / 64)
+
+struct plx_iolimit
+{
+	uint64_t	bps;		/* bytes per second; 0 for no limit */
+	uint64_t	iops;		/* reads per second; 0 for no limit */
+	int		adaptive;
+	int		active;		/* any of the above */
+	double		byte_tokens;
+	double		op_tokens;
+	int64_t		last_ns;	/* when the buckets were last filled */
+	double		lat_ewma;	/* of the time a read takes, in ns */
+	double		lat_base;
+	double		duty;		/* share of the time spent reading */
+	int64_t		adjust_ns;	/* when the duty cycle last changed */
+	uint64_t	waited_ns;
+	uint64_t	backoffs;
+};
+
+extern struct plx_iolimit plx_io;
+
+void plx_io_setup(uint64_t, uint64_t, int);
+int plx_io_idle(void);
+int plx_io_parse_rate(const char *, uint64_t *);
+void plx_io_wait(size_t);
+void plx_io_done(int64_t);
+int64_t plx_io_now(void);
+ssize_t plx_pread(int, void *, size_t, off_t);
+ssize_t plx_read(int, void *, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined IOLIMIT_H */
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "iolimit.h"
+#include "memwatch.h"
+
+#define CGROUP_ROOT	"/sys/fs/cgroup"
+#define PSI_MEMORY	"/proc/pressure/memory"
+
+struct plx_memwatch plx_mem = { .cur_fd = -1, .stat_fd = -1, .psi_fd = -1 };
+
+/*
+ * Read what FD has to say (from the start) into BUF, NUL-terminated.
+ */
+static int
+read_fd(int fd, char *buf, size_t size)
+{
+	ssize_t		n;
+
+	while ((n = pread(fd, buf, size - 1, 0)) < 0 && errno == EINTR)
+		;
+
+	if (n < 0)
+		return -1;
+
+	buf[n] = 0;
+
+	return 0;
+}
+
+static int
+read_file(const char *path, char *buf, size_t size)
+{
+	int		fd, r;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	r = read_fd(fd, buf, size);
+	close(fd);
+
+	return r;
+}
+
+/*
+ * The value of KEY in the "key value" lines of BUF, or 0.
+ */
+static uint64_t
+stat_value(const char *buf, const char *key)
+{
+	size_t		l = strlen(key);
+	const char	*p = buf;
+
+	while (p && *p)
+	{
+		if (!strncmp(p, key, l) && p[l] == ' ')
+			return strtoull(p + l + 1, NULL, 10);
+
+		if ((p = strchr(p, '\n')))
+			++p;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the cgroup with the lowest memory.max on the way up from ours.
+ */
+static void
+find_limit(void)
+{
+	char		buf[4096];
+	char		dir[4096];
+	char		file[4096 + 32];
+	char		*p;
+	uint64_t	max;
+
+	if (read_file("/proc/self/cgroup", buf, sizeof(buf)) < 0)
+		return;
+
+	/* the v2 hierarchy is the "0::" line */
+	for (p = buf; p && strncmp(p, "0::", 3); p = ((p = strchr(p, '\n')) ? p + 1 : NULL))
+		;
+
+	if (!p)
+		return;
+
+	p += 3;
+	p[strcspn(p, "\n")] = 0;
+
+	if (snprintf(dir, sizeof(dir), "%s%s", CGROUP_ROOT, (strcmp(p, "/") ? p : "")) >= (int)sizeof(dir))
+		return;
+
+	while (strlen(dir) > strlen(CGROUP_ROOT))
+	{
+		snprintf(file, sizeof(file), "%s/memory.max", dir);
+
+		if (read_file(file, buf, sizeof(buf)) == 0 && strncmp(buf, "max", 3))
+		{
+			max = strtoull(buf, NULL, 10);
+
+			if (max && (!plx_mem.limit || max < plx_mem.limit))
+			{
+				plx_mem.limit = max;
+
+				if (plx_mem.cur_fd >= 0)
+					close(plx_mem.cur_fd);
+				if (plx_mem.stat_fd >= 0)
+					close(plx_mem.stat_fd);
+
+				snprintf(file, sizeof(file), "%s/memory.current", dir);
+				plx_mem.cur_fd = open(file, O_RDONLY);
+				snprintf(file, sizeof(file), "%s/memory.stat", dir);
+				plx_mem.stat_fd = open(file, O_RDONLY);
+			}
+		}
+
+		*strrchr(dir, '/') = 0;
+	}
+
+	if (plx_mem.cur_fd < 0)
+		plx_mem.limit = 0;
+}
+
+/*
+ * Start watching. Returns -1 if there is nothing to go by:
+ * no memory limit and no pressure stall information.
+ */
+int
+plx_mem_setup(void)
+{
+	find_limit();
+
+	plx_mem.psi_fd = open(PSI_MEMORY, O_RDONLY);
+	plx_mem.active = (plx_mem.limit || plx_mem.psi_fd >= 0);
+
+	return (plx_mem.active ? 0 : -1);
+}
+
+void
+plx_mem_close(void)
+{
+	if (plx_mem.cur_fd >= 0)
+		close(plx_mem.cur_fd);
+	if (plx_mem.stat_fd >= 0)
+		close(plx_mem.stat_fd);
+	if (plx_mem.psi_fd >= 0)
+		close(plx_mem.psi_fd);
+
+	plx_mem.cur_fd = plx_mem.stat_fd = plx_mem.psi_fd = -1;
+	plx_mem.active = 0;
+}
+
+static void
+read_usage(void)
+{
+	char		buf[8192];
+	uint64_t	cur, inactive = 0;
+
+	if (plx_mem.cur_fd < 0 || read_fd(plx_mem.cur_fd, buf, sizeof(buf)) < 0)
+		return;
+
+	cur = strtoull(buf, NULL, 10);
+
+	if (plx_mem.stat_fd >= 0 && read_fd(plx_mem.stat_fd, buf, sizeof(buf)) == 0)
+		inactive = stat_value(buf, "inactive_file");
+
+	plx_mem.used = (cur > inactive ? cur - inactive : 0);
+}
+
+static void
+read_pressure(void)
+{
+	char		buf[512];
+	char		*p;
+
+	if (plx_mem.psi_fd < 0 || read_fd(plx_mem.psi_fd, buf, sizeof(buf)) < 0)
+		return;
+
+	if ((p = strstr(buf, "some avg10=")))
+		plx_mem.psi_some = strtod(p + 11, NULL);
+	if ((p = strstr(buf, "full avg10=")))
+		plx_mem.psi_full = strtod(p + 11, NULL);
+}
+
+/*
+ * The level memory is at: PLX_MEM_NORMAL, PLX_MEM_TIGHT or
+ * PLX_MEM_CRITICAL. Only looked at every PLX_MEM_CHECK_NSEC;
+ * cheap enough to call for every file in between.
+ */
+int
+plx_mem_check(void)
+{
+	int64_t		now;
+	double		ratio = 0;
+	int		want = PLX_MEM_NORMAL;
+
+	if (!plx_mem.active)
+		return plx_mem.level;
+
+	now = plx_io_now();
+
+	if ((now - plx_mem.check_ns) < PLX_MEM_CHECK_NSEC)
+		return plx_mem.level;
+
+	plx_mem.check_ns = now;
+
+	read_usage();
+	read_pressure();
+
+	if (plx_mem.limit)
+		ratio = ((double)plx_mem.used / (double)plx_mem.limit);
+
+	if (ratio >= PLX_MEM_TIGHT_RATIO || plx_mem.psi_some >= PLX_MEM_TIGHT_PSI)
+		want = PLX_MEM_TIGHT;
+	if (ratio >= PLX_MEM_CRITICAL_RATIO || plx_mem.psi_full >= PLX_MEM_CRITICAL_PSI)
+		want = PLX_MEM_CRITICAL;
+
+	if (want > plx_mem.level
+		|| (want < plx_mem.level && ratio < PLX_MEM_RELAX_RATIO && plx_mem.psi_some < PLX_MEM_RELAX_PSI))
+	{
+		plx_mem.level = want;
+		++plx_mem.changes;
+
+		if (want > plx_mem.max_level)
+			plx_mem.max_level = want;
+	}
+
+	return plx_mem.level;
+}
+
+/*
+ * The most memory the process has had resident, in bytes.
+ */
+uint64_t
+plx_mem_peak_rss(void)
+{
+	struct rusage	ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return ((uint64_t)ru.ru_maxrss << 10);
+}
@@ -0,0 +1,63 @@
+#ifndef MEMWATCH_H
+#define MEMWATCH_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Watching how much memory is left, so that a scan in a container makes
+ * do with less instead of being OOM-killed.
+ *
+ * Under cgroup v2, the limit is the lowest memory.max of the cgroup of
+ * the process and of its ancestors, and what counts against it is the
+ * working set of that cgroup: memory.current less the inactive file
+ * pages (memory.stat), which the kernel reclaims before it kills
+ * anything. The pressure stall information in /proc/pressure/memory is
+ * used as well, with or without a limit. Either can raise the level;
+ * it only comes down again once both are well below where it went up,
+ * so that the scan does not flap between settings.
+ */
+
+#define PLX_MEM_CHECK_NSEC	100000000L /* 0.1 s between checks */
+#define PLX_MEM_TIGHT_RATIO	0.75	/* of the limit in use */
+#define PLX_MEM_CRITICAL_RATIO	0.90
+#define PLX_MEM_RELAX_RATIO	0.60
+#define PLX_MEM_TIGHT_PSI	10.0	/* "some" avg10, in % */
+#define PLX_MEM_CRITICAL_PSI	5.0	/* "full" avg10, in % */
+#define PLX_MEM_RELAX_PSI	2.0	/* "some" avg10, in % */
+
+#define PLX_MEM_NORMAL		0
+#define PLX_MEM_TIGHT		1
+#define PLX_MEM_CRITICAL	2
+
+struct plx_memwatch
+{
+	int		active;
+	int		cur_fd;		/* memory.current of the limiting cgroup */
+	int		stat_fd;	/* its memory.stat */
+	int		psi_fd;
+	uint64_t	limit;		/* 0 if none */
+	uint64_t	used;		/* working set at the last check */
+	double		psi_some;
+	double		psi_full;
+	int		level;
+	int		max_level;
+	int64_t		check_ns;
+	uint64_t	changes;	/* of level */
+};
+
+extern struct plx_memwatch plx_mem;
+
+int plx_mem_setup(void);
+void plx_mem_close(void);
+int plx_mem_check(void);
+uint64_t plx_mem_peak_rss(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined MEMWATCH_H */
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "path_table.h"
+
+/*
+ * The names of the directories are kept in the arena NAMES.
+ */
+int
+path_table_init(struct path_table *pt, struct arena *names)
+{
+	memset(pt, 0, sizeof(*pt));
+
+	if (!(pt->dirs = calloc(PT_INITIAL, sizeof(struct dir_entry))))
+		return -1;
+
+	pt->names = names;
+	pt->nr_slots = PT_INITIAL;
+	pt->nr_dirs = 1; /* PT_NO_DIR: no name, length 0 */
+	pt->dirs[PT_NO_DIR].name = "";
+
+	return 0;
+}
+
+/*
+ * Free the table; the names go with their arena.
+ */
+void
+path_table_free(struct path_table *pt)
+{
+	free(pt->dirs);
+	memset(pt, 0, sizeof(*pt));
+}
+
+/*
+ * Add the directory NAME (LEN bytes, ending with a '/') within the
+ * directory PARENT. Returns its id, or PT_NO_DIR if there is no more
+ * memory (or no more ids).
+ */
+uint32_t
+path_table_add(struct path_table *pt, uint32_t parent, const char *name, size_t len)
+{
+	struct dir_entry	*d = NULL;
+
+	if (pt->nr_dirs == pt->nr_slots)
+	{
+		if (pt->nr_slots >= (UINT32_MAX >> 1))
+		{
+			errno = ENOMEM;
+			return PT_NO_DIR;
+		}
+
+		if (!(d = realloc(pt->dirs, (size_t)(pt->nr_slots << 1) * sizeof(struct dir_entry))))
+			return PT_NO_DIR;
+
+		pt->dirs = d;
+		pt->nr_slots <<= 1;
+	}
+
+	d = &pt->dirs[pt->nr_dirs];
+
+	if (!(d->name = arena_strndup(pt->names, name, len, 0)))
+		return PT_NO_DIR;
+
+	d->parent = parent;
+	d->len = pt->dirs[parent].len + (uint32_t)len;
+
+	return pt->nr_dirs++;
+}
+
+/*
+ * Put the path of the file BASE in the directory DIR together in BUF,
+ * of SIZE bytes. The components are copied from the last to the first,
+ * each straight to where it goes. Returns BUF, or NULL if the path does
+ * not fit.
+ */
+char *
+path_table_build(struct path_table *pt, uint32_t dir, const char *base, char *buf, size_t size)
+{
+	struct dir_entry	*d = NULL;
+	size_t			l = strlen(base);
+	size_t			off = path_table_len(pt, dir);
+
+	if ((off + l + 1) > size)
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	memcpy(buf + off, base, l + 1);
+
+	while (dir != PT_NO_DIR)
+	{
+		d = &pt->dirs[dir];
+		off = pt->dirs[d->parent].len;
+		memcpy(buf + off, d->name, d->len - off);
+		dir = d->parent;
+	}
+
+	return buf;
+}
@@ -0,0 +1,52 @@
+#ifndef PATH_TABLE_H
+#define PATH_TABLE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Table of the directories seen by the scan.
+ *
+ * Every directory is kept once, as its last component and the id of the
+ * directory it is in, so a file only needs the id of its directory and
+ * its base name; the path is put together again when the file is opened
+ * or reported. In a deep tree, that saves repeating the same prefix for
+ * every file below it. Id 0 is no directory at all (the parent of the
+ * directory the scan starts in).
+ */
+
+#define PT_NO_DIR	0
+#define PT_INITIAL	1024
+
+struct dir_entry
+{
+	char		*name;	/* last component, with its '/' */
+	uint32_t	parent;
+	uint32_t	len;	/* of the whole path, up to and with the '/' */
+};
+
+struct path_table
+{
+	struct dir_entry	*dirs;
+	uint32_t		nr_dirs;
+	uint32_t		nr_slots;
+	struct arena		*names;
+};
+
+int path_table_init(struct path_table *, struct arena *);
+void path_table_free(struct path_table *);
+uint32_t path_table_add(struct path_table *, uint32_t, const char *, size_t);
+char *path_table_build(struct path_table *, uint32_t, const char *, char *, size_t);
+
+#define path_table_len(pt, dir) ((size_t)(pt)->dirs[(dir)].len)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined PATH_TABLE_H */
@@ -1,7 +1,9 @@
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <openssl/conf.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
@@ -11,11 +13,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
+#include "arena.h"
+#include "cdc.h"
+#include "digest.h"
+#include "digest_cache.h"
+#include "iolimit.h"
+#include "memwatch.h"
+#include "path_table.h"
+#include "sha256_mb.h"
+#include "size_index.h"
+#include "size_sketch.h"
+#include "spill.h"
 
 #define PROG_NAME "pollux"
 #define PROG_BUILD "2.0.4"
@@ -23,9 +37,11 @@
 #define error(m) fprintf(stderr, "%s: %s (%s)\n", __func__, (m), strerror(errno))
 
 #define MAXLINE		1024
+#define PATHLEN		(MAXLINE * 2) /* longest path the scan will build */
 #define BLK_SIZE	8192
 #define TMP_FILE	"/tmp/.dup_files.txt"
-#define HASH_SIZE	64 // sha256 in string format
+#define DIGEST_SIZE	32 // longest digest kept in the index
+#define HASH_SIZE	(DIGEST_SIZE << 1) // in string format
 #define ARROW_COL	"\e[38;5;13m"
 #define BANNER_COL	"\e[38;5;202m"
 #define HIGHLIGHT_COL	"\e[38;5;246m"
@@ -43,37 +59,257 @@ struct file outfile = {0};
 
 static char *hexdigits = "0123456789abcdef";
 
+/*
+ * Digests are kept in binary form and compared a machine word at
+ * a time; they are only hexlified when they are printed.
+ */
+typedef struct
+{
+	uint64_t	w[DIGEST_SIZE / sizeof(uint64_t)];
+} digest_t;
+
+#define digest_eq(a, b) \
+	!((((a)->w[0] ^ (b)->w[0]) | ((a)->w[1] ^ (b)->w[1])) | \
+	  (((a)->w[2] ^ (b)->w[2]) | ((a)->w[3] ^ (b)->w[3])))
+
 struct Node
 {
-	int	array;
-	char	*name;
+	int	flags;
+	uint32_t	dir;	/* directory the file is in (see node_path()) */
+	char	*name;	/* the base name, or the whole path if dir is PT_NO_DIR */
 	size_t	size;
-	struct	Node	*l;
-	struct	Node	*r;
-	struct	Node	*s;
-	char	hash[HASH_SIZE];
 };
 
+/* node flags */
+#define NF_SPARSE 0x1
+#define NF_DIGEST 0x2 /* the digest of the file is known (see Group) */
+#define NF_TINY 0x4 /* the contents of the file follow node->name */
+
 typedef struct Node Node;
 
+/*
+ * A group of files of the same size, as a struct of arrays: member i is
+ * nodes[i], and its digest, once it has one (NF_DIGEST), is digests[i].
+ * The digests are back to back, so a file is matched against all of the
+ * group in one scan of them. Both arrays double when they are full; the
+ * digests are only allocated once one is needed, and the nodes of a new
+ * group (one slot) come with the group itself.
+ *
+ * Once a group has more than GROUP_SET_MIN members, a scan costs more
+ * than a lookup, and the members with a digest are also put in a hash
+ * set keyed by it (open addressing, holding member index + 1 and at most
+ * half full). From then on every member gets a digest; that of a tiny
+ * file is taken from the contents it keeps inline, so it costs no I/O.
+ */
+typedef struct
+{
+	int		nr;
+	int		cap;
+	size_t		size;
+	Node		*nodes;
+	digest_t	*digests;
+	uint32_t	*set;
+	uint32_t	set_mask;
+	uint32_t	set_used;
+} Group;
+
+#define GROUP_SET_MIN	64
+
 /* option flags */
 #define UF_IGNORE_HIDDEN 0x1
 #define UF_NO_DELETE 0x2
 #define UF_QUIET_MODE 0x4
 #define	UF_DEBUG_MODE 0x8
 #define UF_TO_FILE 0x10
-
-static uint16_t user_options;
+#define UF_PROGRESSIVE 0x20
+#define UF_USE_CACHE 0x40
+#define UF_USE_XATTR 0x80
+#define UF_CALIBRATE 0x100
+#define UF_AFALG 0x200
+#define UF_BENCHMARK 0x400
+#define UF_CHUNKS 0x800
+#define UF_IDLE_IO 0x1000
+#define UF_ADAPTIVE_IO 0x2000
+#define UF_BATCH 0x4000
+#define UF_BY_DEVICE 0x8000
+#define UF_SPILL 0x10000
+#define UF_TWO_PASS 0x20000
+#define UF_ADAPTIVE_MEM 0x40000
+
+static uint32_t user_options;
 #define flag_is_set(f) (user_options & (f))
 
 #define clear_struct(s) memset((s), 0, sizeof((*s)))
 
+/*
+ * Fewer blocks allocated than the logical size implies there
+ * are holes in the file (or the data is stored inline)
+ */
+#define file_is_sparse(st) (((off_t)(st)->st_blocks * 512) < (st)->st_size)
+
+#define MAX_EXTENTS	64
+
+/*
+ * Same-sized groups of up to LOCKSTEP_MAX files are compared
+ * directly, CMP_CHUNK bytes at a time, instead of being hashed.
+ */
+#define LOCKSTEP_MAX	3
+#define CMP_CHUNK	65536
+
+/*
+ * In progressive mode, the first round reads PROG_CHUNK bytes of each
+ * member of a group, and each round after that reads twice as much as
+ * the one before, up to PROG_CHUNK_MAX.
+ */
+#define PROG_CHUNK	65536
+#define PROG_CHUNK_MAX	(4 * 1024 * 1024)
+
+/*
+ * The benchmark hashes BENCH_SIZE bytes (from memory) over
+ * and over for BENCH_NSEC with each way of hashing files.
+ */
+#define BENCH_SIZE	(64 * 1024 * 1024)
+#define BENCH_NSEC	1000000000L
+
+/*
+ * Groups of files no bigger than MB_MAX_SIZE are hashed with the
+ * multi-buffer SHA-256, as many files at a time as it has lanes.
+ */
+#define MB_MAX_SIZE	(16 * 1024)
+
+/*
+ * In batch mode, the scan only appends a 16-byte record per file to a
+ * flat array (and the path to a buffer of paths); the records are radix
+ * sorted by size afterwards, and the runs of equal sizes are resolved.
+ * The record is all it costs per file besides the path, and twice that
+ * while the records are being sorted. Paths start on BATCH_PATH_ALIGN
+ * bytes, so that a 32-bit offset in those units reaches 32 GiB of them.
+ */
+struct batch_rec
+{
+	uint64_t	size;
+	uint32_t	path;	/* offset in batch.paths / BATCH_PATH_ALIGN */
+	uint32_t	dev;	/* index into batch.devs */
+};
+
+struct batch_run
+{
+	uint64_t	start;
+	uint32_t	nr;
+	uint32_t	dev;
+};
+
+struct batch
+{
+	struct batch_rec	*recs;
+	uint64_t		nr_recs;
+	uint64_t		recs_size;
+	char			*paths;
+	uint64_t		paths_len;
+	uint64_t		paths_size;
+	dev_t			*devs;
+	uint32_t		nr_devs;
+	uint64_t		nr_runs;
+};
+
+#define BATCH_RECS	65536
+#define BATCH_PATHS	(4 * 1024 * 1024)
+#define BATCH_PATH_ALIGN	8
+
+#define batch_path(rec)	(batch.paths + ((uint64_t)(rec)->path * BATCH_PATH_ALIGN))
+
+/*
+ * With --memory-limit, the scan goes through the same steps as in batch
+ * mode, but the records are sorted on disk (see spill.h), in files in
+ * $TMPDIR (or SPILL_DIR), and the groups come back one at a time.
+ */
+#define SPILL_DIR	"/tmp"
+
+/*
+ * Sets of identical files. A set is made when the first duplicate of a
+ * file is found, with that file as its first member, and is reported
+ * once the scan is over: one keeper is chosen for the whole set and
+ * (unless -N) the rest of it is deleted. The members of all the sets
+ * are in one array, each linked to the next member of its set, and the
+ * sets are found by their digest through a hash table (at most half
+ * full) of set index + 1.
+ */
+struct dup_member
+{
+	char		*path;	/* in the path arena */
+	uint32_t	next;	/* index + 1 of the next member of the set */
+};
+
+struct dup_set
+{
+	digest_t	digest;
+	uint64_t	size;	/* of each member */
+	uint32_t	nr;
+	uint32_t	head;	/* index + 1 of the first and last members */
+	uint32_t	tail;
+};
+
+struct dups
+{
+	struct dup_set		*sets;
+	uint32_t		nr_sets;
+	uint32_t		max_sets;
+	struct dup_member	*members;
+	uint32_t		nr_members;
+	uint32_t		max_members;
+	uint32_t		*slots;
+	uint32_t		mask;
+};
+
+#define DUP_INITIAL	1024
+
+/*
+ * In chunk mode, the chunk index and the table of file pairs take up to
+ * CDC_MEMORY bytes, and the CDC_TOP pairs and directories are reported.
+ */
+#define CDC_MEMORY	(256UL * 1024 * 1024)
+#define CDC_TOP		20
+
+/*
+ * Guess at the bytes of path per file, to size the first block of
+ * the arena that holds the paths (the block grows if it is short).
+ */
+#define ARENA_PATH_GUESS	64
+
+/*
+ * Files of at most TINY_MAX bytes are never hashed: each is read in one
+ * pread() and grouped by its exact contents, which are kept in the node,
+ * just after the name. Empty files need not even be opened.
+ */
+#define TINY_MAX	128
+#define node_tiny(n)	((unsigned char *)(n)->name + strlen((n)->name) + 1)
+
+struct prog_member
+{
+	Node		*node;
+	EVP_MD_CTX	*ctx;
+	int		fd;
+	int		class;
+	struct stat	statb;
+	digest_t	digest;
+};
+
+struct extent
+{
+	off_t	off;
+	off_t	len;
+};
+
 #define __hot __attribute__((hot))
 #define __cold __attribute__((cold))
 #define __noret __attribute__((__noreturn__))
 
 struct stat cur_file_stats;
-Node *root = NULL;
+struct size_index sizes;
+struct arena node_arena;
+struct arena path_arena;
+struct path_table dirs;
+uint32_t scan_dir = PT_NO_DIR; /* directory being scanned */
 int files_scanned = 0;
 int dup_files = 0;
 int tmp_fd = -1;
@@ -86,6 +322,37 @@ char *path = NULL;
 struct rlimit rlims;
 char **user_blacklist = NULL;
 static int istty = 1;
+struct dcache *dcache = NULL;
+char *cache_path = NULL;
+uint64_t xattr_hits = 0;
+uint64_t xattr_stored = 0;
+int mb_lanes = 0;
+int digest_idx = -1;
+int min_strength = PLX_DIGEST_STRENGTH;
+const EVP_MD *hash_md = NULL;
+unsigned int hash_len = DIGEST_SIZE;
+struct plx_afalg afalg = PLX_AFALG_INIT;
+uint64_t afalg_files = 0;
+uint64_t mb_files = 0;
+uint64_t tiny_files = 0;
+uint64_t set_groups = 0;
+struct cdc_index *cdc = NULL;
+size_t cdc_memory = CDC_MEMORY;
+struct batch batch = {0};
+struct spill spill = {0};
+size_t memory_limit = 0;
+uint64_t spill_groups = 0;
+struct size_sketch sketch = {0};
+int sketching = 0; /* first walk of a two-pass scan */
+uint64_t sketch_skipped = 0;
+size_t prog_chunk_max = PROG_CHUNK_MAX;
+int mb_lanes_full = 0;
+int mem_level = PLX_MEM_NORMAL;
+uint64_t mem_events = 0;
+int mem_spilled = 0;
+struct dups dups = {0};
+uint64_t max_bps = 0;
+uint64_t max_iops = 0;
 
 //static int close_start = 3;
 
@@ -118,16 +385,55 @@ char		*line_buf = NULL;
 unsigned char	*hash_buf = NULL;
 char		*hash_hex = NULL;
 char		*block = NULL;
+char		*zero_block = NULL;
+char		*cmp_buf = NULL;
+char		*prog_buf = NULL;
+unsigned char	tiny_buf[TINY_MAX];
 
 struct winsize	winsz;
 int		max_col = 0;
 
-static int insert_file(Node **, char *, size_t, FILE *) __hot __nonnull((1,2,4)) __wur;
-static void free_tree(Node **) __nonnull((1));
+static int insert_file(char *, size_t) __hot __nonnull((1)) __wur;
+static void free_groups(void);
 static int scan_dirs(char *) __nonnull((1)) __wur;
-static int print_and_decide(char *, char *, char *, FILE *) __nonnull((1,2,3,4)) __wur;
+static int dup_add(digest_t *, uint64_t, char *, char *) __nonnull((1,3,4)) __wur;
+static int dup_report(FILE *) __wur;
+static void dup_free(void);
 static int remove_which(char *, char *) __nonnull((1,2)) __wur;
-static unsigned char *get_sha256_file(char *) __nonnull((1)) __wur;
+static unsigned char *get_file_digest(char *) __nonnull((1)) __wur;
+static int get_extents(int, off_t, struct extent *, int) __nonnull((3)) __wur;
+static int holes_prove_distinct(char *, char *, off_t) __nonnull((1,2)) __wur;
+static digest_t *group_digests(Group *) __nonnull((1)) __wur;
+static Node *group_add(Group *) __nonnull((1)) __wur;
+static int group_set_add(Group *, int) __nonnull((1)) __wur;
+static int group_set_build(Group *) __nonnull((1)) __wur;
+static int group_set_find(Group *, digest_t *) __nonnull((1,2)) __wur;
+static int group_find(Group *, char *, int, digest_t *, int *) __nonnull((1,2,4,5)) __wur;
+static char *node_path(Node *, char *) __nonnull((1,2)) __wur;
+static int get_node_digest(Node *, digest_t *) __nonnull((1,2)) __wur;
+static int read_tiny(char *, size_t, unsigned char *) __nonnull((1)) __wur;
+static int get_node_tiny(Node *) __nonnull((1)) __wur;
+static int tiny_digest(const unsigned char *, size_t, digest_t *) __nonnull((3)) __wur;
+static int resolve_tiny(Node **, int) __nonnull((1)) __wur;
+static int lockstep_compare(char **, int, off_t, int *, int) __nonnull((1,4)) __wur;
+static int lockstep_find(Group *, char *, size_t) __nonnull((1,2)) __wur;
+static int resolve_groups(void) __wur;
+static int resolve_group(Node **, int, off_t) __nonnull((1)) __wur;
+static int batch_add(char *, off_t, dev_t) __nonnull((1)) __wur;
+static int batch_resolve(void) __wur;
+static void batch_free(void);
+static int spill_resolve(void) __wur;
+static const char *spill_dir(void) __wur;
+static int spill_switch(void) __wur;
+static void mem_apply(int);
+static void mem_adapt(int);
+static int progressive_split(Node **, int, off_t) __nonnull((1)) __wur;
+static void prog_classify(struct prog_member *, int) __nonnull((1));
+static int mb_digest_members(struct prog_member *, int, off_t) __nonnull((1)) __wur;
+static int cache_peek(char *, unsigned char *) __nonnull((1,2)) __wur;
+static int lookup_digest(char *, struct stat *, unsigned char *) __nonnull((1,2,3)) __wur;
+static void save_digest(char *, struct stat *, unsigned char *, unsigned int) __nonnull((1,2,3));
+static int run_benchmark(void) __wur;
 //static void close_excess_fds(int);
 static void strip_crnl(char *) __nonnull((1));
 static inline char *hexlify(unsigned char *, size_t) __nonnull((1)) __wur;
@@ -143,6 +449,7 @@ static void pollux_init(void) __attribute__((constructor));
 static void pollux_fini(void) __attribute__((destructor));
 static int get_options(int, char *[]) __nonnull((2)) __wur;
 static void print_stats(void);
+static void stats_line(int, char *, ...) __nonnull((2));
 static int divert_streams(int) __wur;
 
 static void print_pollux_logo(void);
@@ -150,6 +457,7 @@ static void print_pollux_logo(void);
 int
 main(int argc, char *argv[])
 {
+	uint64_t	est_files = 0;
 	int 	r = 0;
 
 	if (argc < 2)
@@ -158,9 +466,71 @@ main(int argc, char *argv[])
 	if (get_options(argc, argv) < 0)
 		goto fail;
 
+	if (digest_idx < 0
+		&& (digest_idx = plx_digest_select(min_strength, DIGEST_SIZE, flag_is_set(UF_CALIBRATE))) < 0)
+	{
+		fprintf(stderr, "No digest of at most %d bits has a strength of %d bits\n", DIGEST_SIZE << 3, min_strength);
+		goto fail;
+	}
+
+	if (!(hash_md = plx_digest_md(digest_idx)))
+	{
+		fprintf(stderr, "%s is not available in this build of OpenSSL\n", plx_digests[digest_idx].label);
+		goto fail;
+	}
+
+	hash_len = plx_digests[digest_idx].size;
+	debug("using %s digest", plx_digests[digest_idx].label);
+
+	if (flag_is_set(UF_AFALG|UF_BENCHMARK) && plx_afalg_open(&afalg, digest_idx) < 0)
+		log_err("main: no AF_ALG %s in the kernel; hashing in user space", plx_digests[digest_idx].label);
+
+	if (flag_is_set(UF_BENCHMARK))
+	{
+		if (run_benchmark() < 0)
+			goto fail;
+
+		exit(EXIT_SUCCESS);
+	}
+
 	if (check_file(argv[1]))
 		goto fail;
 
+	/*
+	 * The arenas are sized for as many files as there are inodes in
+	 * use on the file system; only what is used gets backed by memory.
+	 */
+	est_files = arena_estimate_files(argv[1]);
+	arena_init(&node_arena, est_files * sizeof(Node));
+	arena_init(&path_arena, est_files * ARENA_PATH_GUESS);
+	debug("expecting up to %lu files", (unsigned long)est_files);
+
+	/*
+	 * Chunk mode needs every file, so there is nothing to leave out.
+	 */
+	if (flag_is_set(UF_CHUNKS))
+		user_options &= ~UF_TWO_PASS;
+
+	if (flag_is_set(UF_TWO_PASS) && size_sketch_init(&sketch, est_files) < 0)
+	{
+		log_err("main: failed to allocate the size sketch");
+		goto fail;
+	}
+
+	if (flag_is_set(UF_SPILL) && spill_init(&spill, memory_limit, spill_dir()) < 0)
+	{
+		log_err("main: failed to set up spilling to %s", spill_dir());
+		goto fail;
+	}
+
+	if (flag_is_set(UF_ADAPTIVE_MEM) && plx_mem_setup() < 0)
+		log_err("main: no memory limit or pressure information to adapt to");
+
+	if (flag_is_set(UF_IDLE_IO) && plx_io_idle() < 0)
+		log_err("main: failed to set the idle I/O scheduling class");
+
+	plx_io_setup(max_bps, max_iops, flag_is_set(UF_ADAPTIVE_IO));
+
 	/*
 	 * Might be run by a daemon process (e.g., Cron), so test first before
 	 * doing ioctl() for TIOCGWINSZ, otherwise it will fail. Getting terminal
@@ -221,6 +591,28 @@ main(int argc, char *argv[])
 		fd = -1;
 	}
 */
+	if (flag_is_set(UF_USE_CACHE))
+	{
+		if (!cache_path && !(cache_path = dcache_default_path()))
+		{
+			log_err("main: failed to get path of digest cache");
+			goto fail;
+		}
+
+		/*
+		 * Carry on without the cache if it cannot be opened
+		 * (e.g., another scan is already using it).
+		 */
+		if (!(dcache = dcache_open(cache_path)))
+			log_err("main: cannot use digest cache %s", cache_path);
+	}
+
+	if (flag_is_set(UF_CHUNKS) && !(cdc = cdc_open(hash_md, cdc_memory)))
+	{
+		log_err("main: failed to set up the chunk index");
+		goto fail;
+	}
+
 	strncpy(path, argv[1], strlen(argv[1]));
 	path[strlen(argv[1])] = 0;
 
@@ -229,7 +621,60 @@ main(int argc, char *argv[])
 	printf("Starting scan in %s%s\e[m\n\n", HIGHLIGHT_COL, argv[1]);
 
 	time(&start);
-	r = scan_dirs(path);
+
+	/*
+	 * In two-pass mode, the first walk only counts the sizes, and
+	 * the second one keeps the files of sizes seen more than once.
+	 */
+	if (flag_is_set(UF_TWO_PASS))
+	{
+		sketching = 1;
+		r = scan_dirs(path);
+		sketching = 0;
+	}
+
+	if (r == 0)
+		r = scan_dirs(path);
+
+	/*
+	 * In progressive (and batch) mode, the scan only grouped the
+	 * files by size; now find the duplicates within each group.
+	 */
+	if (r == 0 && flag_is_set(UF_PROGRESSIVE|UF_BATCH|UF_SPILL))
+	{
+		/*
+		 * Small groups are hashed with the multi-buffer SHA-256,
+		 * as long as it gives the same digests as the real thing.
+		 */
+		if (EVP_MD_type(hash_md) == NID_sha256 && sha256_mb_init() > 1)
+		{
+			if (sha256_mb_self_test() == 0)
+			{
+				mb_lanes_full = sha256_mb_lanes();
+				mem_apply(mem_level);
+			}
+			else
+				log_err("main: multi-buffer SHA-256 (%s) failed its self-test", sha256_mb_kernel());
+		}
+
+		if (flag_is_set(UF_SPILL))
+			r = spill_resolve();
+		else
+		if (flag_is_set(UF_BATCH))
+			r = batch_resolve();
+		else
+			r = resolve_groups();
+	}
+
+	if (r == 0 && dup_report(tmp_fp) < 0)
+	{
+		log_err("main: dup_report error");
+		r = -1;
+	}
+
+	if (r == 0 && cdc)
+		cdc_report(cdc, stdout, CDC_TOP);
+
 	time(&end);
 
 	lseek(tmp_fd, 0, SEEK_SET);
@@ -271,6 +716,8 @@ scan_dirs(char *path)
 	int		dfd = -1;
 	//int		illegal = 0;
 	register int	loop_cnt = 0;
+	uint32_t	dir = PT_NO_DIR;
+	size_t		dl = 0;
 
 	n = strlen(path);
 
@@ -301,6 +748,24 @@ scan_dirs(char *path)
 		goto fail;
 	}
 
+	/*
+	 * The directory is kept once in the table, as what PATH
+	 * adds to the path of the directory we came from; the
+	 * files in it only refer to it. Counting the sizes
+	 * keeps nothing.
+	 */
+	if (!sketching)
+	{
+		dl = path_table_len(&dirs, scan_dir);
+		if (!(dir = path_table_add(&dirs, scan_dir, path + dl, n - dl)))
+		{
+			log_err("scan_dirs: path_table_add error");
+			goto fail;
+		}
+
+		scan_dir = dir;
+	}
+
 	loop_cnt = 0;
 
 	while ((dinf = readdir(dp)) != NULL)
@@ -338,12 +803,63 @@ scan_dirs(char *path)
 
 		if (S_ISREG(cur_file_stats.st_mode))
 		{
+			if (sketching)
+			{
+				size_sketch_add(&sketch, (uint64_t)cur_file_stats.st_size);
+				continue;
+			}
+
+			mem_adapt(1);
+
 			++files_scanned;
 			used_bytes += cur_file_stats.st_size;
 
+			/*
+			 * In chunk mode, files are only cut into chunks
+			 * and indexed; nothing is reported as a duplicate.
+			 */
+			if (flag_is_set(UF_CHUNKS))
+			{
+				if (cur_file_stats.st_size > 0 && cdc_add_file(cdc, path) < 0 && errno != EACCES)
+				{
+					log_err("scan_dirs: cdc_add_file error for %s", path);
+					return -1;
+				}
+
+				continue;
+			}
+
+			if (flag_is_set(UF_TWO_PASS) && size_sketch_count(&sketch, (uint64_t)cur_file_stats.st_size) < 2)
+			{
+				++sketch_skipped;
+				continue;
+			}
+
+			if (flag_is_set(UF_SPILL))
+			{
+				if (spill_add(&spill, cur_file_stats.st_size, path, strlen(path)) < 0)
+				{
+					log_err("scan_dirs: spill_add error");
+					return -1;
+				}
+
+				continue;
+			}
+
+			if (flag_is_set(UF_BATCH))
+			{
+				if (batch_add(path, cur_file_stats.st_size, cur_file_stats.st_dev) < 0)
+				{
+					log_err("scan_dirs: batch_add error");
+					return -1;
+				}
+
+				continue;
+			}
+
 			debug("adding file %s to tree", path);
 
-			if (insert_file(&root, path, cur_file_stats.st_size, tmp_fp) < 0)
+			if (insert_file(path, cur_file_stats.st_size) < 0)
 				return -1;
 		}
 
@@ -377,6 +893,7 @@ scan_dirs(char *path)
 				goto fail;
 
 			path[n] = 0;
+			scan_dir = dir;
 
 			/* do not need to worry here about open() failing because we
 			 * already previously opened PATH with no problems
@@ -425,6 +942,7 @@ scan_dirs(char *path)
 				goto fail;
 
 			path[n] = 0;
+			scan_dir = dir;
 
 			debug("reopening %s", path);
 
@@ -465,293 +983,2162 @@ scan_dirs(char *path)
 }
 
 int
-insert_file(Node **root, char *fname, size_t size, FILE *fp)
+insert_file(char *fname, size_t size)
 {
+	Group		**root = NULL;
+	Group		*g = NULL;
 	int		i = 0;
-	unsigned char	*cur_file_hash = NULL;
-	unsigned char	*comp_file_hash = NULL;
-	char		*h = NULL;
+	int		r = 0;
+	int		sparse = 0;
+	int		have_digest = 0;
+	int		have_tiny = 0;
+	digest_t	digest;
+	digest_t	*dptr = NULL;
 	Node		*nptr = NULL;
-	size_t		l = 0, rl = 0;
+	char		*base = NULL;
+	char		*npath = NULL;
+	char		nbuf[PATHLEN];
+	size_t		l = 0;
 
-	l = strlen(fname);
-	rl = ((l + 0xf) & ~(0xf));
+	/* the node only keeps the base name */
+	base = fname + path_table_len(&dirs, scan_dir);
+	l = strlen(base);
 
-	if (*root == NULL)
-	{
-		if (!((*root) = malloc(sizeof(Node))))
-		{
-			log_err("insert_file: malloc error");
-			goto fail;
-		}
+	sparse = file_is_sparse(&cur_file_stats);
 
-		memset(*root, 0, sizeof(Node));
+	if (!(root = (Group **)size_index_get(&sizes, (uint64_t)size, 1)))
+	{
+		log_err("insert_file: size_index_get error");
+		goto fail;
+	}
 
-		if (!((*root)->name = calloc(rl, 1)))
+	if (*root == NULL)
+	{
+		if (!(g = arena_alloc(&node_arena, sizeof(Group) + sizeof(Node), sizeof(void *))))
 		{
-			log_err("insert_file: calloc error");
+			log_err("insert_file: arena_alloc error");
 			goto fail;
 		}
 
-		strncpy((*root)->name, fname, l);
-		(*root)->name[l] = 0;
-		(*root)->hash[0] = 0;
-		(*root)->size = size;
-		(*root)->l = NULL;
-		(*root)->r = NULL;
-		(*root)->s = NULL;
-		(*root)->array = 0;
-
-		return 0;
-	}
+		memset(g, 0, sizeof(Group));
+		g->size = size;
+		g->nodes = (Node *)(g + 1);
+		g->cap = 1;
 
-	if (size < (*root)->size)
-	{
-		if (insert_file(&(*root)->l, fname, size, fp) < 0)
-			return -1;
-	}
-	else
-	if (size > (*root)->size)
-	{
-		if (insert_file(&(*root)->r, fname, size, fp) < 0)
-			return -1;
+		*root = g;
+		goto new_member;
 	}
-	else // size == (*root)->size --- possible duplicate file
-	{
-		if (!(cur_file_hash = get_sha256_file(fname)))
-		{
-			if (errno == EACCES)
-				goto fini;
-
-			log_err("insert_file: get_sha256_file error");
 
-			goto fail;
-		}
+	g = *root;
 
+	/* same size as the files of the group --- possible duplicate file */
+	{
 		/*
-		 * HASH_SIZE is defined as the number of bytes in the
-		 * hexlified version; so divide by two so hexlify()
-		 * knows where to stop in its operation.
+		 * Groups are only split after the scan in progressive
+		 * mode, so just add the file to the group for now.
 		 */
-		if (!(h = hexlify(cur_file_hash, (HASH_SIZE >> 1))))
-		{
-			log_err("insert_file: hexlify error");
-			goto fail;
-		}
+		if (flag_is_set(UF_PROGRESSIVE))
+			goto new_member;
 
-		strncpy(hash_hex, h, HASH_SIZE);
-
-		if ((*root)->hash[0] == 0)
+		/*
+		 * Reading a tiny file and comparing its bytes with those of
+		 * the others is cheaper than computing any digest of it.
+		 */
+		if (size <= TINY_MAX)
 		{
-			if (!(comp_file_hash = get_sha256_file((*root)->name)))
-		  {
+			if (read_tiny(fname, size, tiny_buf) < 0)
+			{
 				if (errno == EACCES)
 					goto fini;
 
-				log_err("insert_file: get_sha256_file_r error");
-
-				goto fail;
-		 	}
-
-			if (!(h = hexlify(comp_file_hash, (HASH_SIZE >> 1))))
-		  {
-				log_err("insert_file: hexlify error");
+				log_err("insert_file: read_tiny error");
 				goto fail;
 			}
 
-			strncpy((*root)->hash, h, HASH_SIZE);
-		}
-
-		if (!strncmp(hash_hex, (*root)->hash, HASH_SIZE)) // duplicate files
-		{
-			wasted_bytes += cur_file_stats.st_size;
-			++dup_files;
+			++tiny_files;
 
-			if (print_and_decide(hash_hex, fname, (*root)->name, fp) == -1)
+			if (!g->set && g->nr > GROUP_SET_MIN && group_set_build(g) < 0)
 			{
-				log_err("insert_file: print_and_decide error");
+				log_err("insert_file: group_set_build error");
 				goto fail;
 			}
 
-			goto fini;
-		}
-		else
-		{
-			/*
-			 * Before, those nodes with the same size were joined using a linked list;
-			 * but due to not great performance (presumably due to non-contiguous
-			 * memory accesses while testing for a duplicate file in the linked list),
-			 * using a single array of nodes, which will go as needed. This should ensure
-			 * better spatial locality and thus better usage of the fast cache memories
-			 */
-			if ((*root)->array == 0)
+			if (g->set)
 			{
-				if (!((*root)->s = calloc(1, sizeof(Node))))
+				if (tiny_digest(tiny_buf, size, &digest) < 0)
 				{
-					log_err("insert_file: calloc error");
+					log_err("insert_file: tiny_digest error");
 					goto fail;
 				}
 
-				(*root)->array = 1;
+				have_digest = 1;
 
-				if (!(((*root)->s[0]).name = calloc(rl, 1)))
+				if ((r = group_set_find(g, &digest)) > 0)
 				{
-					log_err("insert_file: calloc error");
-					goto fail;
+					nptr = &g->nodes[r - 1];
+					dptr = &digest;
+					goto duplicate;
 				}
 
-				strncpy((*root)->s[0].name, fname, l);
-				((*root)->s[0]).name[l] = 0;
-
-				strncpy((*root)->s[0].hash, hash_hex, HASH_SIZE);
-
-				((*root)->s[0]).size = size;
-				((*root)->s[0]).array = 0;
-				((*root)->s[0]).l = NULL;
-				((*root)->s[0]).r = NULL;
-				((*root)->s[0]).s = NULL;
-
-				goto fini;
+				have_tiny = 1;
+				goto new_member;
 			}
-			else
-			{
-				/* compare FNAME with two at a time each iteration */
-				for (i = 0; i < ((*root)->array - 1); i+=2)
-				{
-					if (!strncmp(hash_hex, ((*root)->s[i]).hash, HASH_SIZE))
-		 			{
-						wasted_bytes += cur_file_stats.st_size;
-						++dup_files;
-
-						if (print_and_decide(hash_hex, fname, (*root)->s[i].name, fp) == -1)
-						{
-							log_err("insert_file: print_and_decide error");
-							goto fail;
-						}
-
-						goto fini;
-					}
-					else if (!strncmp(hash_hex, ((*root)->s[i+1]).hash, HASH_SIZE))
-					{
-						wasted_bytes += cur_file_stats.st_size;
-						++dup_files;
-
-						if (print_and_decide(hash_hex, fname, (*root)->s[i+1].name, fp) == -1)
-						{
-							log_err("insert_file: print_and_decide error");
-							goto fail;
-						}
 
-						goto fini;
-					}
-					else
-						continue;
-				}
+			for (i = 0; i < g->nr; ++i)
+			{
+				nptr = &g->nodes[i];
 
-				/*
-				 * If array size was 1, for example, the above loop would not have
-				 * run at all, so i would remain at zero, so we'll catch that
-				 * one here
-				 */
-				if (i < (*root)->array)
+				if (get_node_tiny(nptr) < 0)
 				{
-					if (!strncmp(hash_hex, ((*root)->s[i]).hash, HASH_SIZE))
-					{
-						wasted_bytes += cur_file_stats.st_size;
-						++dup_files;
-
-						if (print_and_decide(hash_hex, fname, (*root)->s[i].name, fp) == -1)
-						{
-							log_err("insert_file: print_and_decide error");
-							goto fail;
-						}
-
-						goto fini;
-					}
-				}
-
-
-				/*
-				 * The hash did not match any in the array of file hashes,
-				 * so realloc() the array and insert the filename and hash
-				 * of the new file
-				 */
-				(*root)->array = ((*root)->array + 1);
+					if (errno == EACCES)
+						continue;
 
-				if (!((*root)->s = realloc((*root)->s, (*root)->array * sizeof(Node))))
-				{
-					log_err("insert_file: realloc error");
+					log_err("insert_file: get_node_tiny error");
 					goto fail;
 				}
 
-				nptr = &((*root)->s[((*root)->array - 1)]);
-
-				memset(nptr, 0, sizeof(Node));
-				nptr->array = 0;
-				nptr->l = NULL;
-				nptr->r = NULL;
-				nptr->s = NULL;
+				if (memcmp(tiny_buf, node_tiny(nptr), size))
+					continue;
 
-				if (!(nptr->name = calloc(rl, 1)))
+				if (tiny_digest(node_tiny(nptr), size, &digest) < 0)
 				{
-					log_err("insert_file: malloc error");
+					log_err("insert_file: tiny_digest error");
 					goto fail;
 				}
 
-				strncpy(nptr->name, fname, l);
-				nptr->name[l] = 0;
+				dptr = &digest;
+				goto duplicate;
+			}
 
-				strncpy(nptr->hash, hash_hex, HASH_SIZE);
+			have_tiny = 1;
+			goto new_member;
+		}
 
-				nptr->size = size;
+		/*
+		 * While the group of same-sized files is small, comparing the
+		 * contents directly is cheaper than hashing every file in full:
+		 * it stops at the first block that differs and costs no digest
+		 * CPU. Digests are only computed here for reporting duplicates.
+		 */
+		if ((g->nr + 1) <= LOCKSTEP_MAX)
+		{
+			if ((r = lockstep_find(g, fname, size)) < 0)
+			{
+				if (errno == EACCES)
+					goto fini;
+
+				log_err("insert_file: lockstep_find error");
+				goto fail;
+			}
+
+			if (r == 0)
+				goto new_member;
+
+			nptr = &g->nodes[r - 1];
+
+			if (!group_digests(g))
+			{
+				log_err("insert_file: group_digests error");
+				goto fail;
+			}
+
+			dptr = &g->digests[r - 1];
+
+			if (get_node_digest(nptr, dptr) < 0)
+			{
+				if (errno == EACCES)
+					goto fini;
+
+				log_err("insert_file: get_node_digest error");
+				goto fail;
+			}
+
+			goto duplicate;
+		}
+
+		if ((r = group_find(g, fname, sparse, &digest, &have_digest)) < 0)
+		{
+			if (errno == EACCES)
+				goto fini;
+
+			log_err("insert_file: group_find error");
+			goto fail;
+		}
+
+		if (r > 0) // duplicate files
+		{
+			nptr = &g->nodes[r - 1];
+			dptr = &digest;
+			goto duplicate;
+		}
+
+		/*
+		 * The file did not match any in the group of same-sized
+		 * files, so add the filename (and the hash, if we had to
+		 * compute it) of the new file to the group.
+		 */
+		new_member:
+		if (!(nptr = group_add(g)))
+		{
+			log_err("insert_file: group_add error");
+			goto fail;
+		}
+
+		if (!(nptr->name = arena_strndup(&path_arena, base, l, (have_tiny ? size : 0))))
+		{
+			log_err("insert_file: arena_strndup error");
+			goto fail;
+		}
+
+		nptr->dir = scan_dir;
+		nptr->size = size;
+
+		if (have_digest)
+		{
+			g->digests[g->nr - 1] = digest;
+			nptr->flags |= NF_DIGEST;
+
+			if (g->set && group_set_add(g, g->nr - 1) < 0)
+			{
+				log_err("insert_file: group_set_add error");
+				goto fail;
+			}
+		}
+
+		if (have_tiny)
+		{
+			memcpy(nptr->name + l + 1, tiny_buf, size);
+			nptr->flags |= NF_TINY;
+		}
+
+		if (sparse)
+			nptr->flags |= NF_SPARSE;
+	}
+
+	fini:
+
+	return 0;
+
+	/* FNAME has the same contents as the file in NPTR */
+	duplicate:
+	wasted_bytes += cur_file_stats.st_size;
+	++dup_files;
+
+	if (!(npath = node_path(nptr, nbuf)) || dup_add(dptr, size, npath, fname) < 0)
+	{
+		log_err("insert_file: dup_add error");
+		goto fail;
+	}
+
+	return 0;
+
+	fail:
+
+	return -1;
+}
+
+/*
+ * The digests of the group G, allocated (for as many members as the
+ * group has room for) if it had none yet.
+ */
+digest_t *
+group_digests(Group *g)
+{
+	if (g->digests)
+		return g->digests;
+
+	if (!(g->digests = arena_alloc(&node_arena, g->cap * sizeof(digest_t), sizeof(digest_t))))
+		return NULL;
+
+	memset(g->digests, 0, g->cap * sizeof(digest_t));
+
+	return g->digests;
+}
+
+/*
+ * Make room for a new member at the end of the group G and return
+ * its node (zeroed out). When the group is full, its arrays move to
+ * twice the room in the arena, and the old ones are left behind.
+ */
+Node *
+group_add(Group *g)
+{
+	Node		*n = NULL;
+	digest_t	*d = NULL;
+
+	if (g->nr == g->cap)
+	{
+		if (!(n = arena_alloc(&node_arena, (g->cap << 1) * sizeof(Node), sizeof(void *))))
+			return NULL;
+
+		memcpy(n, g->nodes, g->nr * sizeof(Node));
+
+		if (g->digests)
+		{
+			if (!(d = arena_alloc(&node_arena, (g->cap << 1) * sizeof(digest_t), sizeof(digest_t))))
+				return NULL;
+
+			memcpy(d, g->digests, g->nr * sizeof(digest_t));
+			memset(d + g->nr, 0, ((g->cap << 1) - g->nr) * sizeof(digest_t));
+			g->digests = d;
+		}
+
+		g->nodes = n;
+		g->cap <<= 1;
+	}
+
+	n = &g->nodes[g->nr++];
+	memset(n, 0, sizeof(Node));
+
+	return n;
+}
+
+/*
+ * Put member I of the group G (which has a digest) in the hash set of
+ * the group, doubling the set first if it would be more than half full.
+ * The first word of the digest is the hash (see digest.h).
+ */
+int
+group_set_add(Group *g, int i)
+{
+	uint32_t	*set = NULL;
+	uint32_t	mask = 0;
+	uint32_t	j = 0, k = 0;
+
+	if (((g->set_used + 1) << 1) > (g->set_mask + 1))
+	{
+		mask = (g->set_mask ? ((g->set_mask << 1) | 1) : ((GROUP_SET_MIN << 2) - 1));
+
+		if (!(set = arena_alloc(&node_arena, (size_t)(mask + 1) * sizeof(uint32_t), sizeof(uint32_t))))
+			return -1;
+
+		memset(set, 0, (size_t)(mask + 1) * sizeof(uint32_t));
+
+		for (j = 0; g->set && j <= g->set_mask; ++j)
+		{
+			if (!g->set[j])
+				continue;
+
+			for (k = (uint32_t)g->digests[g->set[j] - 1].w[0] & mask; set[k]; k = ((k + 1) & mask))
+				;
+
+			set[k] = g->set[j];
+		}
+
+		g->set = set;
+		g->set_mask = mask;
+	}
+
+	for (k = (uint32_t)g->digests[i].w[0] & g->set_mask; g->set[k]; k = ((k + 1) & g->set_mask))
+		;
+
+	g->set[k] = (uint32_t)(i + 1);
+	++g->set_used;
+
+	return 0;
+}
+
+/*
+ * Switch the group G to a hash set: every member gets a digest (even
+ * sparse ones, which could not be told apart by their holes for good)
+ * and goes into the set. Tiny files get theirs from their contents.
+ */
+int
+group_set_build(Group *g)
+{
+	Node		*n = NULL;
+	int		i = 0;
+
+	if (!group_digests(g))
+		return -1;
+
+	for (i = 0; i < g->nr; ++i)
+	{
+		n = &g->nodes[i];
+
+		if (!(n->flags & NF_DIGEST) && g->size <= TINY_MAX)
+		{
+			if (get_node_tiny(n) < 0)
+			{
+				if (errno == EACCES)
+					continue;
+
+				return -1;
+			}
+
+			if (tiny_digest(node_tiny(n), n->size, &g->digests[i]) < 0)
+				return -1;
+
+			n->flags |= NF_DIGEST;
+		}
+
+		if (!(n->flags & NF_DIGEST) && get_node_digest(n, &g->digests[i]) < 0)
+		{
+			/* a file we cannot read is never matched */
+			if (errno == EACCES)
+				continue;
+
+			return -1;
+		}
+
+		if (group_set_add(g, i) < 0)
+			return -1;
+	}
+
+	++set_groups;
+	debug("%d files of %lu bytes: switching to a hash set", g->nr, (unsigned long)g->size);
+
+	return 0;
+}
+
+/*
+ * Look DIGEST up in the hash set of the group G. Returns 0 if
+ * no member has it, or (i + 1) if member i does.
+ */
+int
+group_set_find(Group *g, digest_t *digest)
+{
+	uint32_t	j = 0;
+
+	for (j = (uint32_t)digest->w[0] & g->set_mask; g->set[j]; j = ((j + 1) & g->set_mask))
+	{
+		if (digest_eq(digest, &g->digests[g->set[j] - 1]))
+			return (int)g->set[j];
+	}
+
+	return 0;
+}
+
+/*
+ * Look for a file with the same contents as FNAME in the group G. The
+ * digest of FNAME is left in DIGEST once HAVE_DIGEST is set, and those
+ * of the members missing theirs are computed first, so that the whole
+ * group can then be matched in one scan of its digests (or one lookup
+ * in its hash set, for a large group). If FNAME and a member are both
+ * sparse, the regions where their hole layouts disagree are looked at
+ * first, which is often enough to tell them apart without hashing the
+ * member. Returns 0 if no member matches, or (i + 1) if member i does.
+ */
+int
+group_find(Group *g, char *fname, int sparse, digest_t *digest, int *have_digest)
+{
+	Node		*n = NULL;
+	unsigned char	*d = NULL;
+	char		*npath = NULL;
+	char		nbuf[PATHLEN];
+	long		k = 0;
+	int		i = 0, nr_digests = 0;
+
+	if (!group_digests(g))
+		return -1;
+
+	if (!g->set && g->nr > GROUP_SET_MIN && group_set_build(g) < 0)
+		return -1;
+
+	if (g->set)
+	{
+		if (!*have_digest)
+		{
+			if (!(d = get_file_digest(fname)))
+				return -1;
+
+			memcpy(digest, d, DIGEST_SIZE);
+			*have_digest = 1;
+		}
+
+		return group_set_find(g, digest);
+	}
+
+	for (i = 0; i < g->nr; ++i)
+	{
+		n = &g->nodes[i];
+
+		if (!(n->flags & NF_DIGEST))
+		{
+			if (sparse && (n->flags & NF_SPARSE))
+			{
+				if (!(npath = node_path(n, nbuf)))
+					return -1;
+
+				if (holes_prove_distinct(fname, npath, (off_t)n->size))
+				{
+					debug("hole layouts of %s and %s prove they differ", fname, npath);
+					continue;
+				}
+			}
+
+			if (get_node_digest(n, &g->digests[i]) < 0)
+			{
+				if (errno == EACCES)
+					continue;
+
+				return -1;
+			}
+		}
+
+		++nr_digests;
+	}
+
+	if (!nr_digests)
+		return 0;
+
+	if (!*have_digest)
+	{
+		if (!(d = get_file_digest(fname)))
+			return -1;
+
+		memcpy(digest, d, DIGEST_SIZE);
+		*have_digest = 1;
+	}
+
+	/* digests of members without NF_DIGEST are all zeroes: skip them */
+	for (i = 0; i < g->nr; i += (int)k + 1)
+	{
+		if ((k = plx_digest_find((unsigned char *)&g->digests[i], g->nr - i,
+				DIGEST_SIZE, (unsigned char *)digest)) < 0)
+			break;
+
+		if (g->nodes[i + k].flags & NF_DIGEST)
+			return (i + (int)k + 1);
+	}
+
+	return 0;
+}
+
+/*
+ * The path of the file in node N. Nodes made by the scan only keep the
+ * base name and the directory, and the path is put together in BUF (of
+ * PATHLEN bytes); a node holding the whole path just gives its name.
+ */
+char *
+node_path(Node *n, char *buf)
+{
+	if (n->dir == PT_NO_DIR)
+		return n->name;
+
+	return path_table_build(&dirs, n->dir, n->name, buf, PATHLEN);
+}
+
+/*
+ * Compute the digest of the file in node N into DIGEST,
+ * if it is not there already.
+ */
+int
+get_node_digest(Node *n, digest_t *digest)
+{
+	unsigned char	*d = NULL;
+	char		*npath = NULL;
+	char		nbuf[PATHLEN];
+
+	if (n->flags & NF_DIGEST)
+		return 0;
+
+	if (!(npath = node_path(n, nbuf)) || !(d = get_file_digest(npath)))
+		return -1;
+
+	memcpy(digest, d, DIGEST_SIZE);
+	n->flags |= NF_DIGEST;
+
+	return 0;
+}
+
+/*
+ * Read the SIZE bytes of the tiny file FNAME into BUF in one go. An
+ * empty file is not even opened. A file that shrank since it was
+ * scanned is passed over like one we cannot read.
+ */
+int
+read_tiny(char *fname, size_t size, unsigned char *buf)
+{
+	ssize_t		nbytes = 0;
+	int		fd = -1;
+	int		_errno = 0;
+
+	if (size == 0)
+		return 0;
+
+	if ((fd = open(fname, O_RDONLY)) < 0)
+		return -1;
+
+	nbytes = plx_pread(fd, buf, size, 0);
+	_errno = errno;
+	close(fd);
+
+	if (nbytes < 0)
+	{
+		errno = _errno;
+		return -1;
+	}
+
+	if ((size_t)nbytes < size)
+	{
+		errno = EACCES;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the contents of the tiny file in node N into the node,
+ * just after its name, if we do not have them already.
+ */
+int
+get_node_tiny(Node *n)
+{
+	char		*p = NULL;
+	char		*npath = NULL;
+	char		nbuf[PATHLEN];
+	size_t		l = 0;
+
+	if (n->flags & NF_TINY)
+		return 0;
+
+	l = strlen(n->name);
+
+	if (!(npath = node_path(n, nbuf)))
+		return -1;
+
+	/* the old copy of the name is left in the arena */
+	if (!(p = arena_strndup(&path_arena, n->name, l, n->size)))
+		return -1;
+
+	if (read_tiny(npath, n->size, (unsigned char *)p + l + 1) < 0)
+		return -1;
+
+	n->name = p;
+	n->flags |= NF_TINY;
+	++tiny_files;
+
+	return 0;
+}
+
+/*
+ * The digest of a tiny file is only needed to report it as a duplicate
+ * or to key it in the hash set of a large group, and is computed into
+ * DIGEST from its SIZE bytes of contents in BUF.
+ */
+int
+tiny_digest(const unsigned char *buf, size_t size, digest_t *digest)
+{
+	memset(digest, 0, sizeof(*digest));
+
+	if (1 != EVP_Digest(buf, size, (unsigned char *)digest, NULL, hash_md, NULL))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Compare the NR files in FNAMES, all SIZE bytes long, by reading them
+ * in lockstep one chunk at a time. After each round, the members whose
+ * chunks differ are split into separate classes, and members left alone
+ * in a class are dropped so the rest of them is never read. On return,
+ * CLASS[i] is the index of the first member with the same contents as
+ * member i (CLASS[i] == i for a member unlike any before it).
+ *
+ * With FIRST_ONLY set, all that is wanted is which members are like
+ * member 0, so reading stops as soon as member 0 is alone; the classes
+ * of the other members are then not final (but none of them is 0).
+ */
+int
+lockstep_compare(char **fnames, int nr, off_t size, int *class, int first_only)
+{
+	int		fds[LOCKSTEP_MAX];
+	int		next[LOCKSTEP_MAX];
+	int		live = 0;
+	int		i = 0, j = 0, k = 0;
+	int		_errno = 0;
+	ssize_t		nbytes = 0;
+	size_t		toread = 0;
+	off_t		off = 0;
+	char		*chunk_i = NULL;
+
+	if (nr > LOCKSTEP_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * If we have digests of all the files in the cache, there
+	 * is no need to read any of them.
+	 */
+	if (dcache || flag_is_set(UF_USE_XATTR))
+	{
+		for (i = 0; i < nr; ++i)
+		{
+			if (!cache_peek(fnames[i], (unsigned char *)(cmp_buf + (i * CMP_CHUNK))))
+				break;
+		}
+
+		if (i == nr)
+		{
+			for (i = 0; i < nr; ++i)
+			{
+				for (class[i] = i, j = 0; j < i; ++j)
+				{
+					if (class[j] == j && !memcmp(cmp_buf + (i * CMP_CHUNK), cmp_buf + (j * CMP_CHUNK), hash_len))
+					{
+						class[i] = j;
+						break;
+					}
+				}
+			}
+
+			return 0;
+		}
+	}
+
+	for (i = 0; i < nr; ++i)
+		fds[i] = -1;
+
+	for (i = 0; i < nr; ++i)
+	{
+		if ((fds[i] = open(fnames[i], O_RDONLY)) < 0)
+			goto fail;
+
+		class[i] = 0;
+	}
+
+	live = nr;
+
+	for (off = 0; off < size && live > 1 && !(first_only && fds[0] == -1); off += toread)
+	{
+		toread = ((size - off) < CMP_CHUNK ? (size_t)(size - off) : CMP_CHUNK);
+
+		for (i = 0; i < nr; ++i)
+		{
+			if (fds[i] == -1)
+				continue;
+
+			if ((nbytes = plx_pread(fds[i], cmp_buf + (i * CMP_CHUNK), toread, off)) < 0)
+				goto fail;
+
+			/* file shrank under us: make sure it does not match */
+			if ((size_t)nbytes < toread)
+				memset(cmp_buf + (i * CMP_CHUNK) + nbytes, (int)(i + 1), toread - nbytes);
+		}
+
+		/*
+		 * Split each class according to this round's chunk: a member
+		 * joins the class of the first earlier member of its old class
+		 * that read the same bytes, otherwise it leads a new class.
+		 */
+		for (i = 0; i < nr; ++i)
+		{
+			if (fds[i] == -1)
+				continue;
+
+			next[i] = i;
+			chunk_i = cmp_buf + (i * CMP_CHUNK);
+
+			for (j = 0; j < i; ++j)
+			{
+				if (fds[j] == -1 || class[j] != class[i] || next[j] != j)
+					continue;
+
+				if (!memcmp(chunk_i, cmp_buf + (j * CMP_CHUNK), toread))
+				{
+					next[i] = j;
+					break;
+				}
+			}
+		}
+
+		for (i = 0; i < nr; ++i)
+		{
+			if (fds[i] == -1)
+				continue;
+
+			class[i] = next[i];
+		}
+
+		/* drop members that have become the only one in their class */
+		for (i = 0; i < nr; ++i)
+		{
+			if (fds[i] == -1)
+				continue;
+
+			for (k = 0, j = 0; j < nr; ++j)
+			{
+				if (fds[j] != -1 && class[j] == class[i])
+					++k;
+			}
+
+			if (k == 1)
+			{
+				close(fds[i]);
+				fds[i] = -2;
+				class[i] = i;
+			}
+		}
+
+		for (i = 0; i < nr; ++i)
+		{
+			if (fds[i] == -2)
+			{
+				fds[i] = -1;
+				--live;
+			}
+		}
+	}
+
+	for (i = 0; i < nr; ++i)
+	{
+		if (fds[i] != -1)
+			close(fds[i]);
+	}
+
+	return 0;
+
+	fail:
+	_errno = errno;
+
+	for (i = 0; i < nr; ++i)
+	{
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+
+	errno = _errno;
+	return -1;
+}
+
+/*
+ * Compare FNAME with the (mutually distinct) files in the same-sized
+ * group G. Returns 0 if FNAME matches none of them, or (i + 1) if it
+ * matches member i.
+ */
+int
+lockstep_find(Group *g, char *fname, size_t size)
+{
+	char		*fnames[LOCKSTEP_MAX];
+	char		nbufs[LOCKSTEP_MAX - 1][PATHLEN];
+	int		class[LOCKSTEP_MAX];
+	int		nr = 0, i = 0;
+
+	fnames[nr++] = fname;
+
+	for (i = 0; i < g->nr; ++i)
+	{
+		if (!(fnames[nr] = node_path(&g->nodes[i], nbufs[nr - 1])))
+			return -1;
+		++nr;
+	}
+
+	if (lockstep_compare(fnames, nr, (off_t)size, class, 1) < 0)
+		return -1;
+
+	for (i = 1; i < nr; ++i)
+	{
+		if (class[i] == 0)
+			return i;
+	}
+
+	return 0;
+}
+
+/*
+ * Record the member DUP of a group as a duplicate of the member KEEP.
+ */
+static int
+report_duplicate(digest_t *digest, Node *dup, Node *keep)
+{
+	wasted_bytes += dup->size;
+	++dup_files;
+
+	if (dup_add(digest, dup->size, keep->name, dup->name) < 0)
+	{
+		log_err("report_duplicate: dup_add error");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the duplicates within every group of same-sized files
+ * (used in progressive mode once the scan is done). The members
+ * are resolved as copies of the nodes that hold the whole paths,
+ * which are put together one group at a time.
+ */
+int
+resolve_groups(void)
+{
+	Group		*g = NULL;
+	Node		*src = NULL;
+	Node		*nodes = NULL;
+	Node		**members = NULL;
+	char		*paths = NULL;
+	void		*p = NULL;
+	uint64_t	pos = 0;
+	size_t		len = 0, max_len = 0, off = 0;
+	int		nr = 0, max_nr = 0;
+	int		i = 0;
+	int		ret = -1;
+
+	while ((g = size_index_next(&sizes, &pos)))
+	{
+		if (g->nr < 2)
+			continue;
+
+		nr = g->nr;
+
+		for (len = 0, i = 0; i < nr; ++i)
+		{
+			src = &g->nodes[i];
+			len += path_table_len(&dirs, src->dir) + strlen(src->name) + 1;
+		}
+
+		if (nr > max_nr)
+		{
+			if (!(p = realloc(nodes, nr * sizeof(Node))))
+				goto nomem;
+			nodes = p;
+
+			if (!(p = realloc(members, nr * sizeof(Node *))))
+				goto nomem;
+			members = p;
+
+			max_nr = nr;
+		}
+
+		if (len > max_len)
+		{
+			if (!(p = realloc(paths, len)))
+				goto nomem;
+
+			paths = p;
+			max_len = len;
+		}
+
+		for (off = 0, i = 0; i < nr; ++i)
+		{
+			src = &g->nodes[i];
+
+			nodes[i] = *src;
+			nodes[i].name = path_table_build(&dirs, src->dir, src->name, paths + off, len - off);
+			nodes[i].dir = PT_NO_DIR;
+			nodes[i].flags &= ~NF_DIGEST; /* the digests stay with the group */
+			members[i] = &nodes[i];
+
+			off += strlen(nodes[i].name) + 1;
+		}
+
+		mem_adapt(0);
+
+		if (resolve_group(members, nr, (off_t)g->size) < 0)
+			goto out;
+	}
+
+	ret = 0;
+
+	out:
+	free(paths);
+	free(members);
+	free(nodes);
+
+	return ret;
+
+	nomem:
+	log_err("resolve_groups: realloc error");
+	goto out;
+}
+
+/*
+ * Append FNAME to the batch.
+ */
+int
+batch_add(char *fname, off_t size, dev_t dev)
+{
+	struct batch_rec	*rec = NULL;
+	size_t			l = strlen(fname) + 1;
+	size_t			room = ((l + BATCH_PATH_ALIGN - 1) & ~(size_t)(BATCH_PATH_ALIGN - 1));
+	void			*p = NULL;
+	uint32_t		i = 0;
+
+	if (((batch.paths_len + room) / BATCH_PATH_ALIGN) > UINT32_MAX)
+	{
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	if (batch.nr_recs == batch.recs_size)
+	{
+		batch.recs_size = (batch.recs_size ? (batch.recs_size << 1) : BATCH_RECS);
+
+		if (!(p = realloc(batch.recs, batch.recs_size * sizeof(struct batch_rec))))
+			return -1;
+		batch.recs = p;
+	}
+
+	while ((batch.paths_len + room) > batch.paths_size)
+	{
+		batch.paths_size = (batch.paths_size ? (batch.paths_size << 1) : BATCH_PATHS);
+
+		if (!(p = realloc(batch.paths, batch.paths_size)))
+			return -1;
+		batch.paths = p;
+	}
+
+	/* there are seldom more than a handful of devices */
+	for (i = 0; i < batch.nr_devs && batch.devs[i] != dev; ++i)
+		;
+
+	if (i == batch.nr_devs)
+	{
+		if (!(p = realloc(batch.devs, (batch.nr_devs + 1) * sizeof(dev_t))))
+			return -1;
+
+		batch.devs = p;
+		batch.devs[batch.nr_devs++] = dev;
+	}
+
+	memcpy(batch.paths + batch.paths_len, fname, l);
+
+	rec = &batch.recs[batch.nr_recs];
+	rec->size = (uint64_t)size;
+	rec->path = (uint32_t)(batch.paths_len / BATCH_PATH_ALIGN);
+	rec->dev = i;
+
+	batch.paths_len += room;
+	++batch.nr_recs;
+
+	return 0;
+}
+
+/*
+ * Sort the N records in A by size: LSD radix sort, a byte at a time,
+ * skipping the bytes that are the same in every record (most of the
+ * high ones). It is stable, so files of a size stay in scan order.
+ */
+static int
+radix_sort(struct batch_rec *a, uint64_t n)
+{
+	struct batch_rec	*src = a, *dst = NULL, *t = NULL;
+	uint64_t		(*count)[256] = NULL;
+	uint64_t		i, sum, c;
+	int			pass;
+
+	if (n < 2)
+		return 0;
+
+	if (!(dst = malloc(n * sizeof(struct batch_rec))))
+		return -1;
+
+	if (!(count = calloc(8, sizeof(*count))))
+	{
+		free(dst);
+		return -1;
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		for (pass = 0; pass < 8; ++pass)
+			++count[pass][(a[i].size >> (pass << 3)) & 0xff];
+	}
+
+	for (pass = 0; pass < 8; ++pass)
+	{
+		if (count[pass][(a[0].size >> (pass << 3)) & 0xff] == n)
+			continue;
+
+		for (sum = 0, i = 0; i < 256; ++i)
+		{
+			c = count[pass][i];
+			count[pass][i] = sum;
+			sum += c;
+		}
+
+		for (i = 0; i < n; ++i)
+			dst[count[pass][(src[i].size >> (pass << 3)) & 0xff]++] = src[i];
+
+		t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != a)
+	{
+		memcpy(a, src, n * sizeof(struct batch_rec));
+		dst = src;
+	}
+
+	free(dst);
+	free(count);
+
+	return 0;
+}
+
+static int
+batch_run_cmp(const void *a, const void *b)
+{
+	const struct batch_run	*r1 = a;
+	const struct batch_run	*r2 = b;
+
+	if (r1->dev != r2->dev)
+		return (r1->dev < r2->dev ? -1 : 1);
+
+	return (r1->start < r2->start ? -1 : (r1->start > r2->start ? 1 : 0));
+}
+
+/*
+ * Sort the batch by size and resolve each run of two or more files of
+ * the same size, in order of size or, with --by-device, one device at a
+ * time. Only the files in such runs are ever turned into nodes.
+ */
+int
+batch_resolve(void)
+{
+	struct batch_run	*runs = NULL;
+	Node			*nodes = NULL;
+	Node			**members = NULL;
+	uint64_t		i, k, nr_runs = 0;
+	uint32_t		j, max_nr = 0;
+	int			ret = -1;
+
+	if (radix_sort(batch.recs, batch.nr_recs) < 0)
+	{
+		log_err("batch_resolve: radix_sort error");
+		return -1;
+	}
+
+	for (i = 0; i < batch.nr_recs; i = k)
+	{
+		for (k = i + 1; k < batch.nr_recs && batch.recs[k].size == batch.recs[i].size; ++k)
+			;
+
+		if ((k - i) > 1)
+			++nr_runs;
+	}
+
+	if (!(runs = calloc(nr_runs + 1, sizeof(struct batch_run))))
+	{
+		log_err("batch_resolve: calloc error");
+		return -1;
+	}
+
+	for (nr_runs = 0, i = 0; i < batch.nr_recs; i = k)
+	{
+		for (k = i + 1; k < batch.nr_recs && batch.recs[k].size == batch.recs[i].size; ++k)
+			;
+
+		if ((k - i) < 2)
+			continue;
+
+		runs[nr_runs].start = i;
+		runs[nr_runs].nr = (uint32_t)(k - i);
+		runs[nr_runs].dev = batch.recs[i].dev;
+
+		if (runs[nr_runs].nr > max_nr)
+			max_nr = runs[nr_runs].nr;
+
+		++nr_runs;
+	}
+
+	batch.nr_runs = nr_runs;
+
+	if (flag_is_set(UF_BY_DEVICE))
+		qsort(runs, nr_runs, sizeof(struct batch_run), batch_run_cmp);
+
+	if (!(nodes = calloc(max_nr + 1, sizeof(Node))) || !(members = calloc(max_nr + 1, sizeof(Node *))))
+	{
+		log_err("batch_resolve: calloc error");
+		goto out;
+	}
+
+	for (i = 0; i < nr_runs; ++i)
+	{
+		for (j = 0; j < runs[i].nr; ++j)
+		{
+			struct batch_rec	*rec = &batch.recs[runs[i].start + j];
+
+			memset(&nodes[j], 0, sizeof(Node));
+			nodes[j].size = rec->size;
+
+			nodes[j].name = batch_path(rec);
+			members[j] = &nodes[j];
+		}
+
+		mem_adapt(0);
+
+		if (resolve_group(members, (int)runs[i].nr, (off_t)batch.recs[runs[i].start].size) < 0)
+			goto out;
+	}
+
+	ret = 0;
+
+	out:
+	free(members);
+	free(nodes);
+	free(runs);
+
+	return ret;
+}
+
+void
+batch_free(void)
+{
+	free(batch.recs);
+	free(batch.paths);
+	free(batch.devs);
+	memset(&batch, 0, sizeof(batch));
+}
+
+/*
+ * Merge the spilled runs and resolve each group of two or more files
+ * of the same size as it comes. Only one group is in memory at a time,
+ * with its paths read back from the path file.
+ */
+int
+spill_resolve(void)
+{
+	struct spill_rec	rec;
+	struct spill_rec	*recs = NULL;
+	Node			*nodes = NULL;
+	Node			**members = NULL;
+	char			*names = NULL;
+	uint64_t		*offs = NULL;
+	uint64_t		size, nr, max_nr = 0, j;
+	size_t			names_len, names_size = 0, l;
+	void			*p = NULL;
+	int			r, ret = -1;
+
+	if (spill_finish(&spill) < 0)
+	{
+		log_err("spill_resolve: spill_finish error");
+		return -1;
+	}
+
+	r = spill_next(&spill, &rec);
+
+	while (r > 0)
+	{
+		size = rec.size;
+		nr = 0;
+
+		do
+		{
+			if (nr == max_nr)
+			{
+				max_nr = (max_nr ? (max_nr << 1) : 64);
+
+				if (!(p = realloc(recs, max_nr * sizeof(struct spill_rec))))
+					goto nomem;
+				recs = p;
+
+				if (!(p = realloc(offs, max_nr * sizeof(uint64_t))))
+					goto nomem;
+				offs = p;
+
+				if (!(p = realloc(nodes, max_nr * sizeof(Node))))
+					goto nomem;
+				nodes = p;
+
+				if (!(p = realloc(members, max_nr * sizeof(Node *))))
+					goto nomem;
+				members = p;
+			}
+
+			recs[nr++] = rec;
+		} while ((r = spill_next(&spill, &rec)) > 0 && rec.size == size);
+
+		if (nr < 2)
+			continue;
+
+		++spill_groups;
+
+		for (names_len = 0, j = 0; j < nr; ++j)
+		{
+			l = spill_path_len(&recs[j]) + 1;
+
+			while ((names_len + l) > names_size)
+			{
+				names_size = (names_size ? (names_size << 1) : PATHLEN);
+
+				if (!(p = realloc(names, names_size)))
+					goto nomem;
+				names = p;
+			}
+
+			if (spill_path(&spill, &recs[j], names + names_len, l) < 0)
+			{
+				log_err("spill_resolve: spill_path error");
+				goto out;
+			}
+
+			offs[j] = names_len;
+			names_len += l;
+		}
+
+		for (j = 0; j < nr; ++j)
+		{
+			memset(&nodes[j], 0, sizeof(Node));
+			nodes[j].size = size;
+			nodes[j].name = names + offs[j];
+			members[j] = &nodes[j];
+		}
+
+		mem_adapt(0);
+
+		if (resolve_group(members, (int)nr, (off_t)size) < 0)
+			goto out;
+	}
+
+	if (r < 0)
+	{
+		log_err("spill_resolve: spill_next error");
+		goto out;
+	}
+
+	ret = 0;
+
+	out:
+	free(members);
+	free(nodes);
+	free(offs);
+	free(names);
+	free(recs);
+
+	return ret;
+
+	nomem:
+	log_err("spill_resolve: realloc error");
+	goto out;
+}
+
+const char *
+spill_dir(void)
+{
+	const char	*dir = getenv("TMPDIR");
+
+	return ((dir && *dir) ? dir : SPILL_DIR);
+}
+
+/*
+ * Carry on with the scan in spill mode: what was collected so far
+ * (the batch, or the groups of progressive mode) goes to disk, in
+ * as much memory as --memory-limit (or an eighth of the limit of
+ * the cgroup) allows. The base names of the nodes stay where they
+ * are, in the path arena, along with the directories.
+ */
+int
+spill_switch(void)
+{
+	Group		*g = NULL;
+	uint64_t	pos = 0, i;
+	size_t		memory = memory_limit;
+	char		buf[PATHLEN];
+	char		*p = NULL;
+	int		j;
+
+	if (!memory)
+		memory = (size_t)(plx_mem.limit >> 3);
+
+	if (spill_init(&spill, memory, spill_dir()) < 0)
+		goto fail;
+
+	if (flag_is_set(UF_BATCH))
+	{
+		for (i = 0; i < batch.nr_recs; ++i)
+		{
+			p = batch_path(&batch.recs[i]);
+
+			if (spill_add(&spill, batch.recs[i].size, p, strlen(p)) < 0)
+				goto fail;
+		}
+
+		batch_free();
+	}
+	else
+	{
+		while ((g = size_index_next(&sizes, &pos)))
+		{
+			for (j = 0; j < g->nr; ++j)
+			{
+				if (!(p = node_path(&g->nodes[j], buf)))
+					goto fail;
+
+				if (spill_add(&spill, g->size, p, strlen(p)) < 0)
+					goto fail;
+			}
+		}
+
+		size_index_free(&sizes);
+		arena_release(&node_arena);
+
+		if (size_index_init(&sizes) < 0)
+			goto fail;
+	}
+
+	user_options &= ~(UF_BATCH|UF_BY_DEVICE|UF_PROGRESSIVE);
+	user_options |= UF_SPILL;
+
+	return 0;
+
+	fail:
+	log_err("spill_switch: failed to move the scan to %s", spill_dir());
+	spill_free(&spill);
+	return -1;
+}
+
+/*
+ * Settings for memory at LEVEL: the read buffer of progressive
+ * mode (never below what the multi-buffer SHA-256 needs) and how
+ * many files that hashes at once.
+ */
+void
+mem_apply(int level)
+{
+	size_t		chunk = (PROG_CHUNK_MAX >> (level << 1));
+
+	if (chunk != prog_chunk_max)
+	{
+		prog_chunk_max = chunk;
+		free(prog_buf);
+		prog_buf = NULL;
+	}
+
+	mb_lanes = (mb_lanes_full >> level);
+}
+
+/*
+ * See whether memory has got tighter (or looser) since the last time,
+ * and adapt to it. While the scan is still going (CAN_SPILL), a batch
+ * or progressive scan that runs out of room goes on in spill mode.
+ */
+void
+mem_adapt(int can_spill)
+{
+	int		level;
+
+	if (!flag_is_set(UF_ADAPTIVE_MEM) || (level = plx_mem_check()) == mem_level)
+		return;
+
+	debug("memory level %d -> %d (%lu of %lu bytes in use)",
+		mem_level, level, (unsigned long)plx_mem.used, (unsigned long)plx_mem.limit);
+
+	mem_apply(level);
+	++mem_events;
+
+	if (level > mem_level && dcache)
+		dcache_trim(dcache);
+
+	if (level == PLX_MEM_CRITICAL && can_spill
+		&& flag_is_set(UF_BATCH|UF_PROGRESSIVE) && !flag_is_set(UF_SPILL))
+	{
+		if (spill_switch() == 0)
+			mem_spilled = 1;
+	}
+
+	mem_level = level;
+}
+
+/*
+ * Split the NR same-sized files in MEMBERS into sets of identical
+ * files and report them. Small groups are compared in lockstep;
+ * larger ones are split in rounds by progressive_split().
+ */
+int
+resolve_group(Node **members, int nr, off_t size)
+{
+	char		*fnames[LOCKSTEP_MAX];
+	int		class[LOCKSTEP_MAX];
+	digest_t	digests[LOCKSTEP_MAX];
+	int		i = 0;
+
+	if (size <= TINY_MAX)
+		return resolve_tiny(members, nr);
+
+	if (nr > LOCKSTEP_MAX)
+		return progressive_split(members, nr, size);
+
+	for (i = 0; i < nr; ++i)
+		fnames[i] = members[i]->name;
+
+	if (lockstep_compare(fnames, nr, size, class, 0) < 0)
+	{
+		if (errno == EACCES)
+			return 0;
+
+		log_err("resolve_group: lockstep_compare error");
+		return -1;
+	}
+
+	for (i = 0; i < nr; ++i)
+	{
+		if (class[i] == i)
+			continue;
+
+		if (get_node_digest(members[class[i]], &digests[class[i]]) < 0)
+		{
+			if (errno == EACCES)
+				continue;
+
+			log_err("resolve_group: get_node_digest error");
+			return -1;
+		}
+
+		if (report_duplicate(&digests[class[i]], members[i], members[class[i]]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+struct tiny_member
+{
+	Node		*node;
+	int		idx;
+};
+
+static int
+tiny_member_cmp(const void *a, const void *b)
+{
+	const struct tiny_member	*m1 = a;
+	const struct tiny_member	*m2 = b;
+	int				r = 0;
+
+	if ((r = memcmp(node_tiny(m1->node), node_tiny(m2->node), m1->node->size)))
+		return r;
+
+	return (m1->idx < m2->idx ? -1 : 1);
+}
+
+/*
+ * Split a group of NR tiny files by their contents: the members are read
+ * into their nodes and sorted by them, and within each run of identical
+ * members the first one scanned is kept.
+ */
+int
+resolve_tiny(Node **members, int nr)
+{
+	struct tiny_member	*m = NULL;
+	digest_t		digest;
+	int			i = 0, k = 0, n = 0;
+	int			ret = -1;
+
+	if (!(m = calloc(nr, sizeof(struct tiny_member))))
+	{
+		log_err("resolve_tiny: calloc error");
+		return -1;
+	}
+
+	for (i = 0; i < nr; ++i)
+	{
+		if (get_node_tiny(members[i]) < 0)
+		{
+			if (errno == EACCES)
+				continue;
+
+			log_err("resolve_tiny: get_node_tiny error");
+			goto out;
+		}
+
+		m[n].node = members[i];
+		m[n++].idx = i;
+	}
+
+	qsort(m, n, sizeof(struct tiny_member), tiny_member_cmp);
+
+	for (i = 0; i < n; i = k)
+	{
+		for (k = i + 1; k < n && !memcmp(node_tiny(m[i].node), node_tiny(m[k].node), m[i].node->size); ++k)
+		{
+			if (k == (i + 1) && tiny_digest(node_tiny(m[i].node), m[i].node->size, &digest) < 0)
+			{
+				log_err("resolve_tiny: tiny_digest error");
+				goto out;
+			}
+
+			if (report_duplicate(&digest, m[k].node, m[i].node) < 0)
+				goto out;
+		}
+	}
+
+	ret = 0;
+
+	out:
+	free(m);
+	return ret;
+}
+
+static int
+prog_member_cmp(const void *a, const void *b)
+{
+	const struct prog_member	*m1 = a;
+	const struct prog_member	*m2 = b;
+
+	if (m1->class != m2->class)
+		return (m1->class < m2->class ? -1 : 1);
+
+	return memcmp(&m1->digest, &m2->digest, sizeof(m1->digest));
+}
+
+static void
+prog_member_drop(struct prog_member *m)
+{
+	if (m->fd != -1)
+	{
+		close(m->fd);
+		m->fd = -1;
+	}
+
+	if (m->ctx)
+	{
+		EVP_MD_CTX_destroy(m->ctx);
+		m->ctx = NULL;
+	}
+}
+
+/*
+ * Split a large group of same-sized files in rounds. Each round reads the
+ * next chunk of every member still in the running and adds it to that
+ * member's digest; the members are then partitioned by the digest of
+ * everything read so far. A member left on its own can have no duplicate
+ * in the group, so it is dropped at once and the rest of it is never read.
+ * The members still together at the end of the file are identical.
+ */
+int
+progressive_split(Node **members, int nr, off_t size)
+{
+	struct prog_member	*m = NULL;
+	EVP_MD_CTX		*snap = NULL;
+	unsigned int		hashlen = 0;
+	int			live = 0;
+	int			keep_open = 0;
+	int			i = 0, j = 0, k = 0, c = 0;
+	int			ret = -1;
+	int			have_digests = 0;
+	size_t			chunk = PROG_CHUNK;
+	size_t			toread = 0;
+	ssize_t			nbytes = 0;
+	off_t			off = 0;
+
+	if (!prog_buf && !(prog_buf = malloc(prog_chunk_max)))
+	{
+		log_err("progressive_split: malloc error");
+		return -1;
+	}
+
+	if (!(m = calloc(nr, sizeof(struct prog_member))))
+	{
+		log_err("progressive_split: calloc error");
+		return -1;
+	}
+
+	if (!(snap = EVP_MD_CTX_create()))
+		goto out;
+
+	/*
+	 * Keep the files open between rounds unless the group
+	 * is big enough to run us out of file descriptors.
+	 */
+	keep_open = ((rlim_t)nr < (rlims.rlim_cur >> 1));
+
+	for (i = 0; i < nr; ++i)
+	{
+		m[live].node = members[i];
+		m[live].fd = -1;
+		m[live].class = 0;
+
+		if (lstat(members[i]->name, &m[live].statb) < 0)
+			continue;
+
+		if (!(m[live].ctx = EVP_MD_CTX_create())
+			|| 1 != EVP_DigestInit_ex(m[live].ctx, hash_md, NULL))
+		{
+			log_err("progressive_split: failed to create digest context");
+			prog_member_drop(&m[live]);
+			goto out;
+		}
+
+		++live;
+	}
+
+	/*
+	 * If we have digests of all the files in the cache, just split
+	 * the group by those and do not read any of the files.
+	 */
+	if ((dcache || flag_is_set(UF_USE_XATTR)) && live > 1)
+	{
+		for (i = 0; i < live; ++i)
+		{
+			if (!lookup_digest(m[i].node->name, &m[i].statb, (unsigned char *)&m[i].digest))
+				break;
+		}
+
+		if (i == live)
+		{
+			prog_classify(m, live);
+			have_digests = 1;
+			off = size;
+		}
+	}
+
+	/*
+	 * Small files are read whole in one go anyway, so hash
+	 * them side by side instead of one after the other.
+	 */
+	if (!have_digests && mb_lanes > 1 && size > 0 && size <= MB_MAX_SIZE && live > 1)
+	{
+		if ((live = mb_digest_members(m, live, size)) < 0)
+		{
+			live = 0;
+			goto out;
+		}
+
+		prog_classify(m, live);
+		have_digests = 1;
+		off = size;
+	}
+
+	while (off < size && live > 1)
+	{
+		toread = ((size - off) < chunk ? (size_t)(size - off) : chunk);
+
+		for (i = 0; i < live; ++i)
+		{
+			if (m[i].fd == -1 && (m[i].fd = open(m[i].node->name, O_RDONLY)) < 0)
+			{
+				/* cannot read it: leave it out of the group */
+				m[i].class = -1;
+				continue;
+			}
+
+			nbytes = plx_pread(m[i].fd, prog_buf, toread, off);
+
+			if (!keep_open)
+			{
+				close(m[i].fd);
+				m[i].fd = -1;
+			}
+
+			if (nbytes != (ssize_t)toread)
+			{
+				m[i].class = -1;
+				continue;
+			}
+
+			if (1 != EVP_DigestUpdate(m[i].ctx, prog_buf, toread)
+				|| 1 != EVP_MD_CTX_copy_ex(snap, m[i].ctx)
+				|| 1 != EVP_DigestFinal_ex(snap, (unsigned char *)&m[i].digest, &hashlen))
+			{
+				log_err("progressive_split: digest error");
+				goto out;
+			}
+		}
+
+		off += toread;
+
+		qsort(m, live, sizeof(struct prog_member), prog_member_cmp);
+
+		/*
+		 * Each run of equal (class, digest) is a class for the next
+		 * round; runs of one member and unreadable members are dropped.
+		 */
+		for (i = 0, k = 0, c = 0; i < live; i = j)
+		{
+			for (j = i + 1; j < live && !prog_member_cmp(&m[i], &m[j]); ++j)
+				;
+
+			if (m[i].class == -1 || (j - i) == 1)
+			{
+				for (; i < j; ++i)
+					prog_member_drop(&m[i]);
+
+				continue;
+			}
+
+			for (; i < j; ++i)
+			{
+				m[i].class = c;
+				m[k++] = m[i];
+			}
+
+			++c;
+		}
+
+		debug("progressive_split: %d of %d files left after %ld bytes", k, nr, (long)off);
+
+		live = k;
+
+		if (chunk < prog_chunk_max)
+			chunk <<= 1;
+	}
+
+	/* empty files: nothing was read, so nothing was digested yet */
+	if (size == 0 && !have_digests)
+	{
+		for (i = 0; i < live; ++i)
+		{
+			if (1 != EVP_DigestFinal_ex(m[i].ctx, (unsigned char *)&m[i].digest, &hashlen))
+				goto out;
+		}
+	}
+
+	/*
+	 * Only the members that were read to the end have a digest
+	 * of the whole file worth keeping.
+	 */
+	if (!have_digests && live > 1)
+	{
+		for (i = 0; i < live; ++i)
+			save_digest(m[i].node->name, &m[i].statb, (unsigned char *)&m[i].digest, hash_len);
+	}
+
+	/*
+	 * The members still together in a class have the same contents;
+	 * keep the first of each and report the others.
+	 */
+	for (i = 0; i < live; i = j)
+	{
+		for (j = i + 1; j < live && m[j].class == m[i].class; ++j)
+			;
+
+		if ((j - i) < 2)
+			continue;
+
+		for (k = i + 1; k < j; ++k)
+		{
+			if (report_duplicate(&m[i].digest, m[k].node, m[i].node) < 0)
+				goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	if (snap)
+		EVP_MD_CTX_destroy(snap);
+
+	for (i = 0; i < live; ++i)
+		prog_member_drop(&m[i]);
+
+	free(m);
+	return ret;
+}
+
+/*
+ * Number the runs of equal digests among the LIVE members of M
+ * as classes, once every member has the digest of the whole file.
+ */
+static void
+prog_classify(struct prog_member *m, int live)
+{
+	int		i = 0, j = 0, c = 0;
+
+	for (i = 0; i < live; ++i)
+		m[i].class = 0;
+
+	qsort(m, live, sizeof(struct prog_member), prog_member_cmp);
+
+	for (i = 0; i < live; i = j)
+	{
+		for (j = i + 1; j < live && digest_eq(&m[i].digest, &m[j].digest); ++j)
+			;
+
+		for (; i < j; ++i)
+			m[i].class = c;
+
+		++c;
+	}
+}
+
+/*
+ * Compute the digests of the LIVE members of M, all SIZE bytes long
+ * (at most MB_MAX_SIZE), with the multi-buffer SHA-256: the files are
+ * read whole into PROG_BUF, MB_LANES at a time, and hashed together.
+ * Members with a digest in the cache are not read, and unreadable ones
+ * are dropped. Returns the number of members left.
+ */
+static int
+mb_digest_members(struct prog_member *m, int live, off_t size)
+{
+	const unsigned char	*msgs[SHA256_MB_MAX_LANES];
+	int			batch[SHA256_MB_MAX_LANES];
+	unsigned char		out[SHA256_MB_MAX_LANES][SHA256_MB_DIGEST_SIZE];
+	ssize_t			nbytes = 0;
+	int			use_cache = (dcache || flag_is_set(UF_USE_XATTR));
+	int			fd = -1;
+	int			i = 0, k = 0, n = 0;
+
+	for (i = 0; i <= live; ++i)
+	{
+		if (i < live)
+		{
+			m[i].class = 0;
+
+			if (use_cache && lookup_digest(m[i].node->name, &m[i].statb, (unsigned char *)&m[i].digest))
+				continue;
+
+			if ((fd = open(m[i].node->name, O_RDONLY)) < 0)
+			{
+				m[i].class = -1;
+				continue;
+			}
+
+			nbytes = plx_pread(fd, prog_buf + (n * size), (size_t)size, 0);
+			close(fd);
+
+			if (nbytes != (ssize_t)size)
+			{
+				m[i].class = -1;
+				continue;
 			}
+
+			msgs[n] = (unsigned char *)prog_buf + (n * size);
+			batch[n++] = i;
+
+			if (n < mb_lanes)
+				continue;
+		}
+
+		if (n == 0)
+			continue;
+
+		sha256_mb(msgs, (size_t)size, n, out);
+
+		for (k = 0; k < n; ++k)
+		{
+			memcpy(&m[batch[k]].digest, out[k], DIGEST_SIZE);
+			save_digest(m[batch[k]].node->name, &m[batch[k]].statb, out[k], hash_len);
 		}
+
+		mb_files += n;
+		n = 0;
 	}
 
-	fini:
+	for (i = 0, k = 0; i < live; ++i)
+	{
+		if (m[i].class == -1)
+		{
+			prog_member_drop(&m[i]);
+			continue;
+		}
 
-	return 0;
+		m[k++] = m[i];
+	}
 
-	fail:
+	return k;
+}
 
-	return -1;
+/*
+ * Get the digest of FNAME from the cache, if it is there and still valid.
+ */
+int
+cache_peek(char *fname, unsigned char *digest)
+{
+	struct stat	statb;
+
+	if (lstat(fname, &statb) < 0)
+		return 0;
+
+	return lookup_digest(fname, &statb, digest);
+}
+
+/*
+ * Look for a still valid digest of FNAME (whose current status is in
+ * STATB) in the digest cache, then in the file's extended attributes.
+ * DIGEST has room for DIGEST_SIZE bytes; anything but a digest of
+ * hash_len bytes is a miss.
+ */
+int
+lookup_digest(char *fname, struct stat *statb, unsigned char *digest)
+{
+	unsigned int	len = 0;
+
+	if (dcache && dcache_lookup(dcache, statb, EVP_MD_type(hash_md), digest, DIGEST_SIZE, &len)
+		&& len == hash_len)
+		return 1;
+
+	if (flag_is_set(UF_USE_XATTR)
+		&& dcache_xattr_get(fname, statb, EVP_MD_type(hash_md), digest, DIGEST_SIZE, &len) == 1
+		&& len == hash_len)
+	{
+		++xattr_hits;
+
+		if (dcache)
+			dcache_store(dcache, statb, EVP_MD_type(hash_md), digest, len);
+
+		return 1;
+	}
+
+	return 0;
 }
 
+/*
+ * Keep the digest of FNAME, computed when it was as described
+ * in STATB, in the digest cache and/or its extended attributes.
+ */
 void
-free_tree(Node **root)
+save_digest(char *fname, struct stat *statb, unsigned char *digest, unsigned int len)
 {
-	int		i = 0;
+	struct stat	now;
 
-	if (*root == NULL) return;
+	if (flag_is_set(UF_USE_XATTR)
+		&& dcache_xattr_set(fname, statb, EVP_MD_type(hash_md), digest, len) == 0)
+	{
+		++xattr_stored;
 
-	if ((*root)->l)
-		free_tree(&((*root)->l));
-	else
-	if ((*root)->r)
-		free_tree(&((*root)->r));
+		/*
+		 * Setting the attribute changed the file's ctime: if nothing
+		 * else changed, the cache entry should be checked against the
+		 * new one.
+		 */
+		if (lstat(fname, &now) == 0
+			&& now.st_size == statb->st_size
+			&& now.st_mtim.tv_sec == statb->st_mtim.tv_sec
+			&& now.st_mtim.tv_nsec == statb->st_mtim.tv_nsec)
+			statb->st_ctim = now.st_ctim;
+	}
+
+	if (dcache && dcache_store(dcache, statb, EVP_MD_type(hash_md), digest, len) < 0)
+		log_err("save_digest: failed to save digest in cache");
+}
+
+/*
+ * Fill EXT with the data extents of the file open on FD, as reported by
+ * SEEK_DATA/SEEK_HOLE. Returns the number of extents, or -1 if they could
+ * not be determined or there are more than MAX of them.
+ */
+int
+get_extents(int fd, off_t size, struct extent *ext, int max)
+{
+	off_t		data = 0, hole = 0;
+	int		nr = 0;
 
-	if ((*root)->array > 0)
+	while (hole < size)
 	{
-		for (i = 0; i < (*root)->array; ++i)
+		if ((data = lseek(fd, hole, SEEK_DATA)) < 0)
 		{
-			if (((*root)->s[i]).name != NULL)
-			{
-				free(((*root)->s[i]).name);
-				((*root)->s[i]).name = NULL;
-			}
+			if (errno == ENXIO) // only a hole remains
+				break;
+
+			return -1;
 		}
 
-		(*root)->array = 0;
+		if ((hole = lseek(fd, data, SEEK_HOLE)) < 0)
+			return -1;
+
+		if (nr == max)
+			return -1;
+
+		ext[nr].off = data;
+		ext[nr].len = (hole - data);
+		++nr;
+	}
+
+	return nr;
+}
+
+/*
+ * Returns 1 if the file open on FD has any non-zero byte in [OFF,END).
+ */
+static int
+range_has_data(int fd, off_t off, off_t end)
+{
+	ssize_t		nbytes = 0;
+	size_t		toread = 0;
+
+	while (off < end)
+	{
+		toread = ((end - off) < BLK_SIZE ? (size_t)(end - off) : BLK_SIZE);
+
+		if ((nbytes = plx_pread(fd, block, toread, off)) <= 0)
+			return 0;
+
+		if (memcmp(block, zero_block, nbytes))
+			return 1;
+
+		off += nbytes;
 	}
 
-	if ((*root)->name)
+	return 0;
+}
+
+/*
+ * Two sparse files of the same size whose hole layouts differ are not
+ * necessarily different: a data extent can hold nothing but zeroes. But
+ * wherever one file has data and the other a hole is where they are most
+ * likely to differ, so look at those regions first. Returns 1 if a
+ * non-zero byte is found in any of them (the files certainly differ);
+ * 0 if the files need to be compared in full.
+ */
+int
+holes_prove_distinct(char *f1, char *f2, off_t size)
+{
+	struct extent	e1[MAX_EXTENTS];
+	struct extent	e2[MAX_EXTENTS];
+	struct extent	*a = NULL, *b = NULL;
+	int		fd1 = -1, fd2 = -1;
+	int		n1 = 0, n2 = 0, na = 0, nb = 0;
+	int		fda = -1;
+	int		pass = 0, i = 0, j = 0;
+	int		distinct = 0;
+	off_t		cur = 0, end = 0;
+
+	if ((fd1 = open(f1, O_RDONLY)) < 0)
+		goto out;
+
+	if ((fd2 = open(f2, O_RDONLY)) < 0)
+		goto out;
+
+	if ((n1 = get_extents(fd1, size, e1, MAX_EXTENTS)) < 0
+		|| (n2 = get_extents(fd2, size, e2, MAX_EXTENTS)) < 0)
+		goto out;
+
+	if (n1 == n2 && !memcmp(e1, e2, n1 * sizeof(struct extent)))
+		goto out;
+
+	for (pass = 0; pass < 2 && !distinct; ++pass)
 	{
-		free((*root)->name);
-		(*root)->name = NULL;
+		a = (pass ? e2 : e1); na = (pass ? n2 : n1);
+		b = (pass ? e1 : e2); nb = (pass ? n1 : n2);
+		fda = (pass ? fd2 : fd1);
+
+		for (i = 0; i < na && !distinct; ++i)
+		{
+			cur = a[i].off;
+			end = (a[i].off + a[i].len);
+
+			/* the parts of A's extent not covered by data in B */
+			for (j = 0; j < nb && cur < end && !distinct; ++j)
+			{
+				if ((b[j].off + b[j].len) <= cur)
+					continue;
+
+				if (b[j].off >= end)
+					break;
+
+				if (b[j].off > cur)
+					distinct = range_has_data(fda, cur, b[j].off);
+
+				cur = (b[j].off + b[j].len);
+			}
+
+			if (!distinct && cur < end)
+				distinct = range_has_data(fda, cur, end);
+		}
 	}
 
-	free(*root);
-	*root = NULL;
+	out:
+	if (fd1 != -1)
+		close(fd1);
+	if (fd2 != -1)
+		close(fd2);
+
+	return distinct;
+}
+
+void
+free_groups(void)
+{
+	dup_free();
+	arena_release(&node_arena);
+	arena_release(&path_arena);
+	size_index_free(&sizes);
+	path_table_free(&dirs);
 
 	return;
 }
@@ -825,7 +3212,7 @@ signal_handler(int signo)
 
 	time(&end);
 	print_stats();
-	free_tree(&root);
+	free_groups();
 
 	exit(EXIT_SUCCESS);
 }
@@ -851,7 +3238,7 @@ pollux_init(void)
 	signal(SIGINT, signal_handler);
 	signal(SIGQUIT, signal_handler);
 
-	if (!(path = calloc((MAXLINE*2), 1)))
+	if (!(path = calloc(PATHLEN, 1)))
 	{
 		log_err("pollux_init: calloc error (line %d)", __LINE__);
 		goto fail;
@@ -863,7 +3250,19 @@ pollux_init(void)
 		goto fail;
 	}
 
-	if (!(hash_buf = calloc(32, 1)))
+	if (size_index_init(&sizes) < 0)
+	{
+		log_err("pollux_init: size_index_init error");
+		goto fail;
+	}
+
+	if (path_table_init(&dirs, &path_arena) < 0)
+	{
+		log_err("pollux_init: path_table_init error");
+		goto fail;
+	}
+
+	if (!(hash_buf = calloc(EVP_MAX_MD_SIZE, 1)))
 	{
 		log_err("pollux_init: calloc error (line %d)", __LINE__);
 		goto fail;
@@ -881,6 +3280,18 @@ pollux_init(void)
 		goto fail;
 	}
 
+	if (!(zero_block = calloc(BLK_SIZE, 1)))
+	{
+		log_err("pollux_init: calloc error (line %d)", __LINE__);
+		goto fail;
+	}
+
+	if (!(cmp_buf = calloc(LOCKSTEP_MAX, CMP_CHUNK)))
+	{
+		log_err("pollux_init: calloc error (line %d)", __LINE__);
+		goto fail;
+	}
+
 	return;
 
 	fail:
@@ -890,8 +3301,7 @@ pollux_init(void)
 void
 pollux_fini(void)
 {
-	if (root)
-		free_tree(&root);
+	free_groups();
 
 	if (path)
 	{
@@ -923,6 +3333,49 @@ pollux_fini(void)
 		block = NULL;
 	}
 
+	if (zero_block)
+	{
+		free(zero_block);
+		zero_block = NULL;
+	}
+
+	if (cmp_buf)
+	{
+		free(cmp_buf);
+		cmp_buf = NULL;
+	}
+
+	if (prog_buf)
+	{
+		free(prog_buf);
+		prog_buf = NULL;
+	}
+
+	if (dcache)
+	{
+		dcache_close(dcache);
+		dcache = NULL;
+	}
+
+	plx_afalg_close(&afalg);
+
+	if (cdc)
+	{
+		cdc_close(cdc);
+		cdc = NULL;
+	}
+
+	batch_free();
+	spill_free(&spill);
+	size_sketch_free(&sketch);
+	plx_mem_close();
+
+	if (cache_path)
+	{
+		free(cache_path);
+		cache_path = NULL;
+	}
+
 	if (user_blacklist)
 	{
 		int i;
@@ -941,6 +3394,9 @@ get_options(int argc, char *argv[])
 {
 	int		i = 0, j = 0;
 	int		blist_idx = 0;
+	uint64_t	limit = 0;
+	long		val = 0;
+	char		*end = NULL;
 
 	for(i = 0; i < argc; ++i)
 	{
@@ -1000,6 +3456,185 @@ get_options(int argc, char *argv[])
 		{
 			user_options |= UF_IGNORE_HIDDEN;
 		}
+		else if (strcmp("--progressive", argv[i]) == 0
+			|| strcmp("-P", argv[i]) == 0)
+		{
+			user_options |= UF_PROGRESSIVE;
+		}
+		else if (strcmp("--cache", argv[i]) == 0)
+		{
+			user_options |= UF_USE_CACHE;
+		}
+		else if (strcmp("--xattr", argv[i]) == 0)
+		{
+			user_options |= UF_USE_XATTR;
+		}
+		else if (strcmp("--digest", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--digest requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			if (strcmp("auto", argv[i]) == 0)
+				continue;
+
+			if ((digest_idx = plx_digest_index(argv[i])) < 0)
+			{
+				fprintf(stderr, "Unknown digest \"%s\"\n", argv[i]);
+				goto fail;
+			}
+
+			if (plx_digests[digest_idx].size > DIGEST_SIZE)
+			{
+				fprintf(stderr, "Digests longer than %d bits are not supported\n", DIGEST_SIZE << 3);
+				goto fail;
+			}
+		}
+		else if (strcmp("--min-strength", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--min-strength requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			errno = 0;
+			val = strtol(argv[i], &end, 10);
+
+			if (errno || end == argv[i] || *end || val < 0 || val > INT_MAX)
+			{
+				fprintf(stderr, "Invalid digest strength \"%s\" (bits)\n", argv[i]);
+				goto fail;
+			}
+
+			min_strength = (int)val;
+		}
+		else if (strcmp("--calibrate", argv[i]) == 0)
+		{
+			user_options |= UF_CALIBRATE;
+		}
+		else if (strcmp("--afalg", argv[i]) == 0)
+		{
+			user_options |= UF_AFALG;
+		}
+		else if (strcmp("--benchmark", argv[i]) == 0)
+		{
+			user_options |= UF_BENCHMARK;
+		}
+		else if (strcmp("--max-rate", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--max-rate requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			if (plx_io_parse_rate(argv[i], &max_bps) < 0)
+			{
+				fprintf(stderr, "Invalid rate \"%s\"\n", argv[i]);
+				goto fail;
+			}
+		}
+		else if (strcmp("--max-iops", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--max-iops requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			if (plx_io_parse_rate(argv[i], &max_iops) < 0)
+			{
+				fprintf(stderr, "Invalid rate \"%s\"\n", argv[i]);
+				goto fail;
+			}
+		}
+		else if (strcmp("--idle-io", argv[i]) == 0)
+		{
+			user_options |= UF_IDLE_IO;
+		}
+		else if (strcmp("--adaptive-io", argv[i]) == 0)
+		{
+			user_options |= UF_ADAPTIVE_IO;
+		}
+		else if (strcmp("--batch", argv[i]) == 0)
+		{
+			user_options |= UF_BATCH;
+		}
+		else if (strcmp("--by-device", argv[i]) == 0)
+		{
+			user_options |= (UF_BATCH|UF_BY_DEVICE);
+		}
+		else if (strcmp("--memory-limit", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--memory-limit requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			if (plx_io_parse_rate(argv[i], &limit) < 0 || limit < 1)
+			{
+				fprintf(stderr, "Invalid memory limit \"%s\"\n", argv[i]);
+				goto fail;
+			}
+
+			memory_limit = (size_t)limit;
+			user_options |= UF_SPILL;
+		}
+		else if (strcmp("--adaptive-memory", argv[i]) == 0)
+		{
+			user_options |= UF_ADAPTIVE_MEM;
+		}
+		else if (strcmp("--two-pass", argv[i]) == 0)
+		{
+			user_options |= UF_TWO_PASS;
+		}
+		else if (strcmp("--chunks", argv[i]) == 0)
+		{
+			user_options |= (UF_CHUNKS|UF_NO_DELETE);
+		}
+		else if (strcmp("--chunk-memory", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--chunk-memory requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			if (atol(argv[i]) < 1)
+			{
+				fprintf(stderr, "--chunk-memory must be at least 1 MiB\n");
+				goto fail;
+			}
+
+			cdc_memory = ((size_t)atol(argv[i]) << 20);
+		}
+		else if (strcmp("--cache-file", argv[i]) == 0)
+		{
+			if ((i + 1) >= argc)
+			{
+				fprintf(stderr, "--cache-file requires an argument\n");
+				goto fail;
+			}
+			++i;
+
+			if (!(cache_path = strdup(argv[i])))
+			{
+				error("failed to copy cache file path");
+				goto fail;
+			}
+
+			user_options |= UF_USE_CACHE;
+		}
 		else if (strcmp("--quiet", argv[i]) == 0
 			|| strcmp("-q", argv[i]) == 0)
 		{
@@ -1283,6 +3918,129 @@ print_stats(void)
 		((double)wasted_bytes/(double)used_bytes)*100);
 	}
 
+	stats_line(fd, "%22s: %s%s\n",
+		"Digest",
+		plx_digests[digest_idx].label,
+		(flag_is_set(UF_CALIBRATE)?" (calibrated)":""));
+
+	if (dcache)
+	{
+		stats_line(fd, "%22s: %lu hit%s, %lu miss%s (%lu stale)\n",
+			"Digest cache",
+			(unsigned long)dcache->stats.hits,
+			(dcache->stats.hits==1?"":"s"),
+			(unsigned long)dcache->stats.misses,
+			(dcache->stats.misses==1?"":"es"),
+			(unsigned long)dcache->stats.stale);
+	}
+
+	if (flag_is_set(UF_USE_XATTR))
+	{
+		stats_line(fd, "%22s: %lu hit%s, %lu stored\n",
+			"Digest xattrs",
+			(unsigned long)xattr_hits,
+			(xattr_hits==1?"":"s"),
+			(unsigned long)xattr_stored);
+	}
+
+	if (afalg_files)
+	{
+		stats_line(fd, "%22s: %lu file%s\n",
+			"Hashed by the kernel",
+			(unsigned long)afalg_files,
+			(afalg_files==1?"":"s"));
+	}
+
+	if (plx_io.waited_ns || plx_io.backoffs)
+	{
+		stats_line(fd, "%22s: %.2lf s (%lu backoff%s)\n",
+			"Throttled",
+			(double)plx_io.waited_ns / 1e9,
+			(unsigned long)plx_io.backoffs,
+			(plx_io.backoffs==1?"":"s"));
+	}
+
+	if (flag_is_set(UF_BATCH))
+	{
+		stats_line(fd, "%22s: %lu file%s, %lu group%s of the same size\n",
+			"Batch",
+			(unsigned long)batch.nr_recs,
+			(batch.nr_recs==1?"":"s"),
+			(unsigned long)batch.nr_runs,
+			(batch.nr_runs==1?"":"s"));
+	}
+
+	if (flag_is_set(UF_SPILL))
+	{
+		stats_line(fd, "%22s: %lu file%s in %u run%s (%u merge pass%s), %lu group%s of the same size\n",
+			"Spilled",
+			(unsigned long)spill.nr_spilled,
+			(spill.nr_spilled==1?"":"s"),
+			spill.nr_written,
+			(spill.nr_written==1?"":"s"),
+			spill.nr_passes + (spill.nr_written ? 1 : 0),
+			((spill.nr_passes + (spill.nr_written ? 1 : 0))==1?"":"es"),
+			(unsigned long)spill_groups,
+			(spill_groups==1?"":"s"));
+	}
+
+	if (flag_is_set(UF_TWO_PASS))
+	{
+		stats_line(fd, "%22s: %lu file%s of a unique size left out (%lu KiB sketch)\n",
+			"Two-pass",
+			(unsigned long)sketch_skipped,
+			(sketch_skipped==1?"":"s"),
+			(unsigned long)(size_sketch_bytes(&sketch) >> 10));
+	}
+
+	if (dups.nr_sets)
+	{
+		stats_line(fd, "%22s: %lu\n",
+			"Sets of duplicates",
+			(unsigned long)dups.nr_sets);
+	}
+
+	if (set_groups)
+	{
+		stats_line(fd, "%22s: %lu group%s of over %d files\n",
+			"Hashed by digest",
+			(unsigned long)set_groups,
+			(set_groups==1?"":"s"),
+			GROUP_SET_MIN);
+	}
+
+	if (tiny_files)
+	{
+		stats_line(fd, "%22s: %lu file%s\n",
+			"Compared inline",
+			(unsigned long)tiny_files,
+			(tiny_files==1?"":"s"));
+	}
+
+	if (mb_files)
+	{
+		stats_line(fd, "%22s: %lu file%s (%s, %d lanes)\n",
+			"Multi-buffer SHA-256",
+			(unsigned long)mb_files,
+			(mb_files==1?"":"s"),
+			sha256_mb_kernel(),
+			mb_lanes_full);
+	}
+
+	stats_line(fd, "%22s: %.1lf MiB\n",
+		"Peak RSS",
+		(double)plx_mem_peak_rss() / (1024 * 1024));
+
+	if (flag_is_set(UF_ADAPTIVE_MEM) && plx_mem.active)
+	{
+		stats_line(fd, "%22s: %lu adaptation%s, highest level %s%s\n",
+			"Memory pressure",
+			(unsigned long)mem_events,
+			(mem_events==1?"":"s"),
+			(plx_mem.max_level == PLX_MEM_CRITICAL ? "critical" : (plx_mem.max_level == PLX_MEM_TIGHT ? "tight" : "normal")),
+			(mem_spilled ? ", switched to spill mode" : ""));
+	}
+
 	fputc(0x0a, stdout);
 
 	if (flag_is_set(UF_QUIET_MODE))
@@ -1297,6 +4055,31 @@ print_stats(void)
 	return;
 }
 
+/*
+ * Print an extra line of stats (to FD in quiet mode).
+ */
+void
+stats_line(int fd, char *fmt, ...)
+{
+	va_list		args;
+
+	va_start(args, fmt);
+	vsnprintf(line_buf, MAXLINE, fmt, args);
+	va_end(args);
+
+	if (flag_is_set(UF_QUIET_MODE))
+	{
+		if (fd > 0 && write(fd, line_buf, strlen(line_buf)) < 0)
+			return;
+	}
+	else
+	{
+		fputs(line_buf, stdout);
+	}
+
+	return;
+}
+
 int
 remove_which(char *c1, char *c2)
 {
@@ -1379,68 +4162,220 @@ remove_which(char *c1, char *c2)
 	return 1;
 }
 
+/*
+ * Append a copy of PATH to the set S.
+ */
+static int
+dup_append(struct dup_set *s, char *path)
+{
+	struct dup_member	*m = NULL;
+	void			*p = NULL;
+
+	if (dups.nr_members == dups.max_members)
+	{
+		if (dups.max_members >= (UINT32_MAX >> 1))
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+
+		dups.max_members = (dups.max_members ? (dups.max_members << 1) : DUP_INITIAL);
+
+		if (!(p = realloc(dups.members, dups.max_members * sizeof(struct dup_member))))
+			return -1;
+
+		dups.members = p;
+	}
+
+	m = &dups.members[dups.nr_members];
+
+	if (!(m->path = arena_strndup(&path_arena, path, strlen(path), 0)))
+		return -1;
+
+	m->next = 0;
+	++dups.nr_members;
+
+	if (s->tail)
+		dups.members[s->tail - 1].next = dups.nr_members;
+	else
+		s->head = dups.nr_members;
+
+	s->tail = dups.nr_members;
+	++s->nr;
+
+	return 0;
+}
+
+/*
+ * Add DUP to the set of the files of SIZE bytes with DIGEST, making the
+ * set (with KEEP, the file DUP was found to be the same as) if it is the
+ * first duplicate of KEEP.
+ */
 int
-print_and_decide(char *hash, char *f1, char *f2, FILE *fp)
+dup_add(digest_t *digest, uint64_t size, char *keep, char *dup)
 {
-	int		choice = 0;
+	struct dup_set	*s = NULL;
+	uint32_t	*slots = NULL;
+	uint32_t	mask = 0;
+	uint32_t	i = 0, k = 0;
+	void		*p = NULL;
 
-	if (!flag_is_set(UF_NO_DELETE))
+	for (k = (dups.slots ? ((uint32_t)digest->w[0] & dups.mask) : 0); dups.slots && dups.slots[k]; k = ((k + 1) & dups.mask))
+	{
+		s = &dups.sets[dups.slots[k] - 1];
+
+		if (s->size == size && digest_eq(&s->digest, digest))
+			return dup_append(s, dup);
+	}
+
+	if (((dups.nr_sets + 1) << 1) > (dups.slots ? (dups.mask + 1) : 0))
 	{
-		choice = remove_which(f1, f2);
-		if (choice < 0)
+		mask = (dups.slots ? ((dups.mask << 1) | 1) : ((DUP_INITIAL << 1) - 1));
+
+		if (!(slots = calloc((size_t)mask + 1, sizeof(uint32_t))))
 			return -1;
 
-		if (choice == 1)
+		for (i = 0; i < dups.nr_sets; ++i)
 		{
-			fprintf(fp, "%s\n", f1);
+			for (k = ((uint32_t)dups.sets[i].digest.w[0] & mask); slots[k]; k = ((k + 1) & mask))
+				;
+
+			slots[k] = i + 1;
 		}
-		else
+
+		free(dups.slots);
+		dups.slots = slots;
+		dups.mask = mask;
+	}
+
+	if (dups.nr_sets == dups.max_sets)
+	{
+		dups.max_sets = (dups.max_sets ? (dups.max_sets << 1) : DUP_INITIAL);
+
+		if (!(p = realloc(dups.sets, dups.max_sets * sizeof(struct dup_set))))
+			return -1;
+
+		dups.sets = p;
+	}
+
+	s = &dups.sets[dups.nr_sets++];
+	memset(s, 0, sizeof(*s));
+	s->digest = *digest;
+	s->size = size;
+
+	for (k = ((uint32_t)digest->w[0] & dups.mask); dups.slots[k]; k = ((k + 1) & dups.mask))
+		;
+
+	dups.slots[k] = dups.nr_sets;
+
+	if (dup_append(s, keep) < 0 || dup_append(s, dup) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Report every set of identical files, in the order they were found.
+ * The keeper of a set is chosen in one pass over it, each member taking
+ * the place of the keeper so far if remove_which() would rather delete
+ * that one, and (unless -N, when FP is NULL) the rest of the set is
+ * written to FP to be deleted.
+ */
+int
+dup_report(FILE *fp)
+{
+	struct dup_set		*s = NULL;
+	struct dup_member	*m = NULL;
+	uint32_t		i = 0, j = 0, keep = 0;
+	int			choice = 0;
+	int			del = 0;
+	char			*h = NULL;
+
+	del = !flag_is_set(UF_NO_DELETE);
+
+	for (i = 0; i < dups.nr_sets; ++i)
+	{
+		s = &dups.sets[i];
+		keep = s->head;
+
+		if (del)
+		{
+			for (j = dups.members[s->head - 1].next; j; j = dups.members[j - 1].next)
+			{
+				if ((choice = remove_which(dups.members[j - 1].path, dups.members[keep - 1].path)) < 0)
+					return -1;
+
+				if (choice == 2)
+					keep = j;
+			}
+		}
+
+		if (!(h = hexlify((unsigned char *)&s->digest, hash_len)))
+			return -1;
+
+		memcpy(hash_hex, h, (hash_len << 1) + 1);
+
+		for (j = s->head; j; j = m->next)
 		{
-			fprintf(fp, "%s\n", f2);
+			m = &dups.members[j - 1];
+
+			if (del && j != keep)
+				fprintf(fp, "%s\n", m->path);
+
+			fprintf(stdout, "%s%s\e[m %s%.*s%s\n",
+				ARROW_COL,
+				(j == s->head ? " _" : "|_"),
+				((del && j != keep) ? "\e[9;38;5;88m" : ""),
+				istty ? max_col : 1024,
+				m->path,
+				((del && j != keep) ? "\e[m" : ""));
 		}
 
 		fprintf(stdout,
-			"%s _\e[m %s%.*s%s\n"
-			"%s|_\e[m %s%.*s%s\n"
 			"%s|\e[m\n"
-			"%s`--->\e[m[\e[38;5;10m%s\e[m]\n\n",
+			"%s`--->\e[m[\e[38;5;10m%s\e[m] %u files, %lu bytes reclaimable\n\n",
 			ARROW_COL,
-			(choice==1?"\e[9;38;5;88m":""),
-			max_col,
-			f1,
-			(choice==1?"\e[m":""),
 			ARROW_COL,
-			(choice==2?"\e[9;38;5;88m":""),
-			max_col,
-			f2,
-			(choice==2?"\e[m":""),
-			ARROW_COL,
-			ARROW_COL,
-			hash);
+			hash_hex,
+			s->nr,
+			(unsigned long)((s->nr - 1) * s->size));
 	}
-	else
+
+	return 0;
+}
+
+void
+dup_free(void)
+{
+	free(dups.sets);
+	free(dups.members);
+	free(dups.slots);
+	memset(&dups, 0, sizeof(dups));
+}
+
+/*
+ * Feed LEN zero bytes into the digest (the contents of a hole).
+ */
+static int
+digest_zeroes(EVP_MD_CTX *ctx, off_t len)
+{
+	size_t		n = 0;
+
+	while (len > 0)
 	{
-		fprintf(stdout,
-			"%s _\e[m %.*s\n"
-			"%s|_\e[m %.*s\n"
-			"%s|\e[m\n"
-			"%s`--->\e[m[\e[38;5;10m%s\e[m]\n\n",
-			ARROW_COL,
-			istty ? max_col : 1024,
-			f1,
-			ARROW_COL,
-			istty ? max_col : 1024,
-			f2,
-			ARROW_COL,
-			ARROW_COL,
-			hash);
+		n = (len < BLK_SIZE ? (size_t)len : BLK_SIZE);
+
+		if (1 != EVP_DigestUpdate(ctx, zero_block, n))
+			return -1;
+
+		len -= n;
 	}
 
-	return(0);
+	return 0;
 }
 
 unsigned char *
-get_sha256_file(char *fname)
+get_file_digest(char *fname)
 {
 	EVP_MD_CTX		*ctx = NULL;
 	int			fd = -1;
@@ -1449,23 +4384,98 @@ get_sha256_file(char *fname)
 	struct stat		statb;
 	size_t			toread = 0;
 	ssize_t			nbytes = 0;
+	off_t			pos = 0, data = 0, hole = 0;
 
 	clear_struct(&statb);
 	if (lstat(fname, &statb) < 0)
 		goto fail;
 
+	if (lookup_digest(fname, &statb, hash_buf))
+		return(hash_buf);
+
 	if ((fd = open(fname, O_RDONLY)) < 0)
 		goto fail;
 
+	/*
+	 * Let the kernel hash the file if we can (the sparse
+	 * path below does less work for files with holes).
+	 */
+	if (afalg.tfm != -1 && !file_is_sparse(&statb)
+		&& plx_afalg_digest(&afalg, fd, statb.st_size, hash_buf) == 0)
+	{
+		hashlen = hash_len;
+		++afalg_files;
+		goto done;
+	}
+
 	if (!(ctx = EVP_MD_CTX_create()))
 		goto fail;
 
-	if (1 != EVP_DigestInit_ex(ctx, EVP_sha256(), NULL))
+	if (1 != EVP_DigestInit_ex(ctx, hash_md, NULL))
 		goto fail;
 
+	/*
+	 * For sparse files, only read the data extents; the holes
+	 * are fed into the digest as runs of zeroes without doing
+	 * any I/O for them.
+	 */
+	if (file_is_sparse(&statb))
+	{
+		while (pos < statb.st_size)
+		{
+			if ((data = lseek(fd, pos, SEEK_DATA)) < 0)
+			{
+				if (errno != ENXIO)
+					goto plain_read;
+
+				data = statb.st_size;
+			}
+
+			if (data > pos && digest_zeroes(ctx, (data - pos)) < 0)
+				goto fail;
+
+			if (data >= statb.st_size)
+				break;
+
+			if ((hole = lseek(fd, data, SEEK_HOLE)) < 0)
+				goto plain_read;
+
+			for (pos = data; pos < hole; pos += nbytes)
+			{
+				toread = ((hole - pos) < BLK_SIZE ? (size_t)(hole - pos) : BLK_SIZE);
+
+				/* 0: the file shrank since it was scanned */
+				if ((nbytes = plx_pread(fd, block, toread, pos)) == 0)
+					goto plain_read;
+
+				if (nbytes < 0)
+					goto fail;
+
+				if (1 != EVP_DigestUpdate(ctx, block, nbytes))
+					goto fail;
+			}
+		}
+
+		goto final;
+	}
+
+	plain_read:
+	/*
+	 * If the sparse path gave up part way, anything already
+	 * fed into the digest is no good, so start over and read
+	 * the file up to wherever it ends now.
+	 */
+	if (file_is_sparse(&statb))
+	{
+		if (1 != EVP_DigestInit_ex(ctx, hash_md, NULL))
+			goto fail;
+
+		lseek(fd, 0, SEEK_SET);
+	}
+
 	toread = statb.st_size;
 
-	while (toread > 0 && (nbytes = read(fd, block, BLK_SIZE)) > 0)
+	while (toread > 0 && (nbytes = plx_read(fd, block, BLK_SIZE)) > 0)
 	{
 		block[nbytes] = 0;
 		if (1 != EVP_DigestUpdate(ctx, block, nbytes))
@@ -1473,9 +4483,13 @@ get_sha256_file(char *fname)
 		toread -= nbytes;
 	}
 
+	final:
 	if (1 != EVP_DigestFinal_ex(ctx, hash_buf, &hashlen))
 		goto fail;
 
+	done:
+	save_digest(fname, &statb, hash_buf, hashlen);
+
 	close(fd);
 	if (ctx != NULL)
 	{
@@ -1529,6 +4543,129 @@ strip_crnl(char *line)
 	return;
 }
 
+/*
+ * Hash the file open on FD, SIZE bytes long, in user space the same
+ * way get_file_digest() does, into OUT.
+ */
+static int
+bench_evp(int fd, off_t size, unsigned char *out)
+{
+	EVP_MD_CTX	*ctx = NULL;
+	ssize_t		nbytes = 0;
+	off_t		pos = 0;
+
+	if (!(ctx = EVP_MD_CTX_create()))
+		return -1;
+
+	if (1 != EVP_DigestInit_ex(ctx, hash_md, NULL))
+		goto fail;
+
+	for (pos = 0; pos < size; pos += nbytes)
+	{
+		if ((nbytes = pread(fd, block, BLK_SIZE, pos)) <= 0)
+			goto fail;
+
+		if (1 != EVP_DigestUpdate(ctx, block, nbytes))
+			goto fail;
+	}
+
+	if (1 != EVP_DigestFinal_ex(ctx, out, NULL))
+		goto fail;
+
+	EVP_MD_CTX_destroy(ctx);
+	return 0;
+
+	fail:
+	EVP_MD_CTX_destroy(ctx);
+	return -1;
+}
+
+/*
+ * Report how fast files are hashed in user space and by the kernel
+ * (if it has the digest chosen), so the faster can be chosen for this
+ * host. The data is kept in a memory file, so the disks play no part.
+ */
+int
+run_benchmark(void)
+{
+	unsigned char	evp_out[EVP_MAX_MD_SIZE];
+	unsigned char	alg_out[EVP_MAX_MD_SIZE];
+	struct timespec	t0, t1;
+	double		rate[2] = { 0.0, 0.0 };
+	uint64_t	bytes = 0;
+	long		ns = 0;
+	off_t		off = 0;
+	int		fd = -1;
+	int		i = 0;
+	int		ret = -1;
+
+	if ((fd = memfd_create("pollux-benchmark", MFD_CLOEXEC)) < 0)
+	{
+		log_err("run_benchmark: memfd_create error");
+		return -1;
+	}
+
+	for (off = 0; off < BENCH_SIZE; off += BLK_SIZE)
+	{
+		for (i = 0; i < BLK_SIZE; ++i)
+			block[i] = (char)(((uint32_t)(off + i) * 2654435761u) >> 13);
+
+		if (write(fd, block, BLK_SIZE) != BLK_SIZE)
+		{
+			log_err("run_benchmark: write error");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		if (i == 1 && afalg.tfm == -1)
+			break;
+
+		bytes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+
+		do
+		{
+			if ((i == 0 ? bench_evp(fd, BENCH_SIZE, evp_out)
+				: plx_afalg_digest(&afalg, fd, BENCH_SIZE, alg_out)) < 0)
+			{
+				log_err("run_benchmark: failed to hash with %s", (i == 0 ? "EVP" : "AF_ALG"));
+				goto out;
+			}
+
+			bytes += BENCH_SIZE;
+
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			ns = ((t1.tv_sec - t0.tv_sec) * 1000000000L) + (t1.tv_nsec - t0.tv_nsec);
+		} while (ns < BENCH_NSEC);
+
+		rate[i] = ((double)bytes * 1e3) / (double)ns; /* MB/s */
+	}
+
+	fprintf(stdout, "%22s: %s\n", "Digest", plx_digests[digest_idx].label);
+	fprintf(stdout, "%22s: %.1f MB/s\n", "EVP (read)", rate[0]);
+
+	if (afalg.tfm == -1)
+	{
+		fprintf(stdout, "%22s: not available\n", "AF_ALG (splice)");
+	}
+	else
+	{
+		fprintf(stdout, "%22s: %.1f MB/s%s\n",
+			"AF_ALG (splice)",
+			rate[1],
+			(memcmp(evp_out, alg_out, hash_len) ? " (digests differ!)" : ""));
+
+		fprintf(stdout, "%22s: %s\n", "Faster", (rate[1] > rate[0] ? "--afalg" : "EVP (the default)"));
+	}
+
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
 char *
 hexlify(unsigned char *data, size_t len)
 {
@@ -1574,6 +4711,47 @@ display_usage(const int exit_status)
 		"-B,--blacklist <term> [,<term>]      Blacklist keywords from scan\n"
 		"-N,--nodelete                        Don't delete the duplicate files\n"
 		"--nohidden                           Ignore hidden files (begin with '.')\n"
+		"-P,--progressive                     Group files by size first, then split\n"
+		"                                     each group in rounds of growing chunks\n"
+		"--batch                              Collect the files in a flat array, sort it\n"
+		"                                     by size and only then compare and hash\n"
+		"--by-device                          In batch mode, go one device at a time\n"
+		"--memory-limit <bytes>               Sort the files by size on disk (in $TMPDIR)\n"
+		"                                     in about <bytes> of memory, however many\n"
+		"                                     there are (suffixes K, M and G allowed)\n"
+		"--adaptive-memory                    Watch the cgroup memory limit and memory\n"
+		"                                     pressure, and use less memory as it runs\n"
+		"                                     short (going to disk in batch and\n"
+		"                                     progressive modes)\n"
+		"--two-pass                           Walk the tree twice: count the sizes first,\n"
+		"                                     then keep only the files whose size was\n"
+		"                                     seen more than once\n"
+		"--cache                              Keep digests in ~/.cache/pollux/digests.db\n"
+		"                                     and reuse them while files are unchanged\n"
+		"--cache-file <file>                  Use <file> as the digest cache\n"
+		"--xattr                              Keep digests in user.pollux.* extended\n"
+		"                                     attributes of the files and reuse them\n"
+		"--digest <name|auto>                 Digest to use (md5, sha1, sha256, sha512-256,\n"
+		"                                     sha3-256, blake2s256); by default, the fastest\n"
+		"                                     one for this CPU that is strong enough\n"
+		"--min-strength <bits>                Collision resistance the digest chosen must\n"
+		"                                     have (default: 128)\n"
+		"--calibrate                          Time the candidate digests to choose one\n"
+		"--afalg                              Have the kernel hash the files (AF_ALG),\n"
+		"                                     splicing them in without copying\n"
+		"--benchmark                          Compare the speed of hashing in user space\n"
+		"                                     and by the kernel with the digest chosen\n"
+		"--max-rate <bytes>                   Read at most <bytes> per second (suffixes\n"
+		"                                     K, M and G allowed)\n"
+		"--max-iops <n>                       Issue at most <n> reads per second\n"
+		"--idle-io                            Only read when the disk is otherwise idle\n"
+		"                                     (idle I/O scheduling class)\n"
+		"--adaptive-io                        Slow down while read latency is high\n"
+		"--chunks                             Cut files into content-defined chunks and\n"
+		"                                     report the data shared by pairs of files\n"
+		"                                     and by directories (deletes nothing)\n"
+		"--chunk-memory <MiB>                 Memory for the chunk index (default: 256);\n"
+		"                                     beyond it, chunks are sampled\n"
 		"--out <file>                         Print results to output file\n"
 		"-q,--quiet                           Only output final stats\n"
 		"-D,--debug                           Run in debug mode\n"
@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_X86_KERNELS 1
+#endif
+#include "sha256_mb.h"
+
+#define BLOCK_SIZE 64
+
+static const uint32_t K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t H0[8] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/*
+ * A kernel runs the compression function over one block of each of
+ * its LANES messages. The state is kept word-major: word W of lane L
+ * is at st[(W * lanes) + L].
+ */
+struct mb_kernel
+{
+	const char	*name;
+	int		lanes;
+	void		(*compress)(uint32_t *, const unsigned char *const *);
+	int		(*usable)(void);
+};
+
+#define ror32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline uint32_t
+load_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void
+compress_x1(uint32_t *st, const unsigned char *const *blk)
+{
+	uint32_t	w[16];
+	uint32_t	a, b, c, d, e, f, g, h, t1, t2;
+	int		t;
+
+	a = st[0]; b = st[1]; c = st[2]; d = st[3];
+	e = st[4]; f = st[5]; g = st[6]; h = st[7];
+
+	for (t = 0; t < 64; ++t)
+	{
+		if (t < 16)
+		{
+			w[t] = load_be32(blk[0] + (t << 2));
+		}
+		else
+		{
+			w[t & 15] += (ror32(w[(t - 15) & 15], 7) ^ ror32(w[(t - 15) & 15], 18) ^ (w[(t - 15) & 15] >> 3))
+				+ w[(t - 7) & 15]
+				+ (ror32(w[(t - 2) & 15], 17) ^ ror32(w[(t - 2) & 15], 19) ^ (w[(t - 2) & 15] >> 10));
+		}
+
+		t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t & 15];
+		t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+	st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+static int
+scalar_usable(void)
+{
+	return 1;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * Load words WORD0 .. WORD0+7 of one block from each of eight lanes
+ * and transpose them, so that OUT[i] holds word WORD0+i of every lane.
+ */
+__attribute__((target("avx2")))
+static inline void
+load_words_x8(const unsigned char *const *blk, int word0, __m256i *out)
+{
+	const __m256i	bswap = _mm256_set_epi8(
+				12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+				12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i		r[8], t[8], u[8];
+	int		i;
+
+	for (i = 0; i < 8; ++i)
+		r[i] = _mm256_loadu_si256((const __m256i *)(blk[i] + (word0 << 2)));
+
+	for (i = 0; i < 8; i += 2)
+	{
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+
+	for (i = 0; i < 8; i += 4)
+	{
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+
+	for (i = 0; i < 4; ++i)
+	{
+		out[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), bswap);
+		out[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), bswap);
+	}
+}
+
+#define ror256(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define xor256(a, b, c) _mm256_xor_si256(_mm256_xor_si256((a), (b)), (c))
+
+__attribute__((target("avx2")))
+static void
+compress_x8(uint32_t *st, const unsigned char *const *blk)
+{
+	__m256i		w[16];
+	__m256i		s[8];
+	__m256i		a, b, c, d, e, f, g, h, t1, t2;
+	int		t;
+
+	for (t = 0; t < 8; ++t)
+		s[t] = _mm256_loadu_si256((const __m256i *)(st + (t << 3)));
+
+	load_words_x8(blk, 0, w);
+	load_words_x8(blk, 8, w + 8);
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (t = 0; t < 64; ++t)
+	{
+		if (t >= 16)
+		{
+			w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15],
+					xor256(ror256(w[(t - 15) & 15], 7), ror256(w[(t - 15) & 15], 18), _mm256_srli_epi32(w[(t - 15) & 15], 3))),
+				_mm256_add_epi32(w[(t - 7) & 15],
+					xor256(ror256(w[(t - 2) & 15], 17), ror256(w[(t - 2) & 15], 19), _mm256_srli_epi32(w[(t - 2) & 15], 10))));
+		}
+
+		t1 = _mm256_add_epi32(_mm256_add_epi32(h, xor256(ror256(e, 6), ror256(e, 11), ror256(e, 25))),
+			_mm256_add_epi32(_mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)),
+				_mm256_add_epi32(_mm256_set1_epi32((int)K[t]), w[t & 15])));
+		t2 = _mm256_add_epi32(xor256(ror256(a, 2), ror256(a, 13), ror256(a, 22)),
+			_mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))));
+
+		h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+		d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+	}
+
+	s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b);
+	s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+	s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+	s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], h);
+
+	for (t = 0; t < 8; ++t)
+		_mm256_storeu_si256((__m256i *)(st + (t << 3)), s[t]);
+}
+
+#define ror512(x, n) _mm512_ror_epi32((x), (n))
+#define xor512(a, b, c) _mm512_ternarylogic_epi32((a), (b), (c), 0x96)
+#define ch512(e, f, g) _mm512_ternarylogic_epi32((e), (f), (g), 0xca)
+#define maj512(a, b, c) _mm512_ternarylogic_epi32((a), (b), (c), 0xe8)
+
+__attribute__((target("avx512f,avx2")))
+static void
+compress_x16(uint32_t *st, const unsigned char *const *blk)
+{
+	__m512i		w[16];
+	__m512i		s[8];
+	__m256i		lo[16], hi[16];
+	__m512i		a, b, c, d, e, f, g, h, t1, t2;
+	int		t;
+
+	for (t = 0; t < 8; ++t)
+		s[t] = _mm512_loadu_si512((const void *)(st + (t << 4)));
+
+	load_words_x8(blk, 0, lo);
+	load_words_x8(blk, 8, lo + 8);
+	load_words_x8(blk + 8, 0, hi);
+	load_words_x8(blk + 8, 8, hi + 8);
+
+	for (t = 0; t < 16; ++t)
+		w[t] = _mm512_inserti64x4(_mm512_castsi256_si512(lo[t]), hi[t], 1);
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (t = 0; t < 64; ++t)
+	{
+		if (t >= 16)
+		{
+			w[t & 15] = _mm512_add_epi32(_mm512_add_epi32(w[t & 15],
+					xor512(ror512(w[(t - 15) & 15], 7), ror512(w[(t - 15) & 15], 18), _mm512_srli_epi32(w[(t - 15) & 15], 3))),
+				_mm512_add_epi32(w[(t - 7) & 15],
+					xor512(ror512(w[(t - 2) & 15], 17), ror512(w[(t - 2) & 15], 19), _mm512_srli_epi32(w[(t - 2) & 15], 10))));
+		}
+
+		t1 = _mm512_add_epi32(_mm512_add_epi32(h, xor512(ror512(e, 6), ror512(e, 11), ror512(e, 25))),
+			_mm512_add_epi32(ch512(e, f, g), _mm512_add_epi32(_mm512_set1_epi32((int)K[t]), w[t & 15])));
+		t2 = _mm512_add_epi32(xor512(ror512(a, 2), ror512(a, 13), ror512(a, 22)), maj512(a, b, c));
+
+		h = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+		d = c; c = b; b = a; a = _mm512_add_epi32(t1, t2);
+	}
+
+	s[0] = _mm512_add_epi32(s[0], a); s[1] = _mm512_add_epi32(s[1], b);
+	s[2] = _mm512_add_epi32(s[2], c); s[3] = _mm512_add_epi32(s[3], d);
+	s[4] = _mm512_add_epi32(s[4], e); s[5] = _mm512_add_epi32(s[5], f);
+	s[6] = _mm512_add_epi32(s[6], g); s[7] = _mm512_add_epi32(s[7], h);
+
+	for (t = 0; t < 8; ++t)
+		_mm512_storeu_si512((void *)(st + (t << 4)), s[t]);
+}
+
+static int
+avx2_usable(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int
+avx512_usable(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+/* best first */
+static const struct mb_kernel kernels[] =
+{
+#ifdef HAVE_X86_KERNELS
+	{ "avx512", 16, compress_x16, avx512_usable },
+	{ "avx2", 8, compress_x8, avx2_usable },
+#endif
+	{ "scalar", 1, compress_x1, scalar_usable }
+};
+
+#define NR_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const struct mb_kernel *kernel = &kernels[NR_KERNELS - 1];
+
+/*
+ * Hash the NR messages in MSGS, all LEN bytes long, with kernel K,
+ * putting the digest of MSGS[i] in OUT[i].
+ */
+static void
+mb_run(const struct mb_kernel *k, const unsigned char *const *msgs, size_t len, int nr, unsigned char (*out)[SHA256_MB_DIGEST_SIZE])
+{
+	unsigned char		tail[SHA256_MB_MAX_LANES][BLOCK_SIZE << 1];
+	const unsigned char	*src[SHA256_MB_MAX_LANES];
+	const unsigned char	*blk[SHA256_MB_MAX_LANES];
+	uint32_t		st[8 * SHA256_MB_MAX_LANES];
+	uint64_t		bits = (uint64_t)len << 3;
+	size_t			full = len / BLOCK_SIZE;
+	size_t			rem = len % BLOCK_SIZE;
+	size_t			tail_blocks = ((rem + 9) <= BLOCK_SIZE ? 1 : 2);
+	size_t			b;
+	int			lanes = k->lanes;
+	int			base, n, l, w;
+
+	for (base = 0; base < nr; base += lanes)
+	{
+		n = ((nr - base) < lanes ? (nr - base) : lanes);
+
+		/*
+		 * All the messages have the same length, so every lane has the
+		 * same number of blocks; spare lanes just hash the first message
+		 * of the batch again.
+		 */
+		for (l = 0; l < lanes; ++l)
+		{
+			src[l] = msgs[base + (l < n ? l : 0)];
+
+			memset(tail[l], 0, sizeof(tail[l]));
+			if (rem)
+				memcpy(tail[l], src[l] + (full * BLOCK_SIZE), rem);
+			tail[l][rem] = 0x80;
+
+			for (w = 0; w < 8; ++w)
+				tail[l][(tail_blocks * BLOCK_SIZE) - 1 - w] = (unsigned char)(bits >> (w << 3));
+
+			for (w = 0; w < 8; ++w)
+				st[(w * lanes) + l] = H0[w];
+		}
+
+		for (b = 0; b < full; ++b)
+		{
+			for (l = 0; l < lanes; ++l)
+				blk[l] = src[l] + (b * BLOCK_SIZE);
+
+			k->compress(st, blk);
+		}
+
+		for (b = 0; b < tail_blocks; ++b)
+		{
+			for (l = 0; l < lanes; ++l)
+				blk[l] = tail[l] + (b * BLOCK_SIZE);
+
+			k->compress(st, blk);
+		}
+
+		for (l = 0; l < n; ++l)
+		{
+			for (w = 0; w < 8; ++w)
+			{
+				out[base + l][(w << 2)] = (unsigned char)(st[(w * lanes) + l] >> 24);
+				out[base + l][(w << 2) + 1] = (unsigned char)(st[(w * lanes) + l] >> 16);
+				out[base + l][(w << 2) + 2] = (unsigned char)(st[(w * lanes) + l] >> 8);
+				out[base + l][(w << 2) + 3] = (unsigned char)st[(w * lanes) + l];
+			}
+		}
+	}
+}
+
+/*
+ * Select the widest kernel this CPU can run; returns its number of lanes.
+ */
+int
+sha256_mb_init(void)
+{
+	size_t		i;
+
+	for (i = 0; i < NR_KERNELS; ++i)
+	{
+		if (kernels[i].usable())
+		{
+			kernel = &kernels[i];
+			break;
+		}
+	}
+
+	return kernel->lanes;
+}
+
+int
+sha256_mb_lanes(void)
+{
+	return kernel->lanes;
+}
+
+const char *
+sha256_mb_kernel(void)
+{
+	return kernel->name;
+}
+
+void
+sha256_mb(const unsigned char *const *msgs, size_t len, int nr, unsigned char (*out)[SHA256_MB_DIGEST_SIZE])
+{
+	mb_run(kernel, msgs, len, nr, out);
+}
+
+static int
+unhex(const char *hex, unsigned char *out)
+{
+	int		i;
+	unsigned int	v;
+
+	for (i = 0; i < SHA256_MB_DIGEST_SIZE; ++i)
+	{
+		if (sscanf(hex + (i << 1), "%2x", &v) != 1)
+			return -1;
+
+		out[i] = (unsigned char)v;
+	}
+
+	return 0;
+}
+
+/*
+ * Check every kernel the CPU can run against the FIPS 180-4 examples,
+ * then against the scalar kernel for lengths around the block and
+ * padding boundaries, with different contents in every lane and a
+ * partly filled last batch. Returns 0 if they all agree.
+ */
+int
+sha256_mb_self_test(void)
+{
+	static const struct
+	{
+		const char	*msg;
+		const char	*digest;
+	} kat[] =
+	{
+		{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" }
+	};
+	static const size_t lens[] = { 0, 1, 55, 56, 63, 64, 65, 119, 120, 127, 128, 1000 };
+	const unsigned char	*msgs[SHA256_MB_MAX_LANES + 3];
+	unsigned char		expect[SHA256_MB_DIGEST_SIZE];
+	unsigned char		ref[SHA256_MB_MAX_LANES + 3][SHA256_MB_DIGEST_SIZE];
+	unsigned char		got[SHA256_MB_MAX_LANES + 3][SHA256_MB_DIGEST_SIZE];
+	unsigned char		*data = NULL;
+	size_t			i, j, k;
+	int			nr, l;
+	int			ret = -1;
+
+	if (!(data = malloc((SHA256_MB_MAX_LANES + 3) * 1000)))
+		return -1;
+
+	for (i = 0; i < (SHA256_MB_MAX_LANES + 3) * 1000; ++i)
+		data[i] = (unsigned char)((i * 2654435761u) >> 13);
+
+	for (k = 0; k < NR_KERNELS; ++k)
+	{
+		if (!kernels[k].usable())
+			continue;
+
+		for (i = 0; i < sizeof(kat) / sizeof(kat[0]); ++i)
+		{
+			if (unhex(kat[i].digest, expect) < 0)
+				goto out;
+
+			for (l = 0; l < SHA256_MB_MAX_LANES; ++l)
+				msgs[l] = (const unsigned char *)kat[i].msg;
+
+			mb_run(&kernels[k], msgs, strlen(kat[i].msg), SHA256_MB_MAX_LANES, got);
+
+			for (l = 0; l < SHA256_MB_MAX_LANES; ++l)
+			{
+				if (memcmp(got[l], expect, SHA256_MB_DIGEST_SIZE))
+					goto out;
+			}
+		}
+
+		nr = kernels[k].lanes + 3;
+
+		for (j = 0; j < sizeof(lens) / sizeof(lens[0]); ++j)
+		{
+			for (l = 0; l < nr; ++l)
+				msgs[l] = data + (l * 1000);
+
+			mb_run(&kernels[NR_KERNELS - 1], msgs, lens[j], nr, ref);
+			mb_run(&kernels[k], msgs, lens[j], nr, got);
+
+			if (memcmp(ref, got, nr * SHA256_MB_DIGEST_SIZE))
+				goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	free(data);
+	return ret;
+}
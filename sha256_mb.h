@@ -0,0 +1,34 @@
+#ifndef SHA256_MB_H
+#define SHA256_MB_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Multi-buffer SHA-256.
+ *
+ * Hashes several independent messages of the same length at once, one
+ * message per 32-bit lane of a vector register: 16 lanes with AVX-512,
+ * 8 with AVX2, and a plain scalar loop on anything else. For small files,
+ * this hides the latency of the dependent rounds of SHA-256 and the cost
+ * of a digest context per file; the output is plain FIPS 180-4 SHA-256.
+ */
+
+#define SHA256_MB_DIGEST_SIZE	32
+#define SHA256_MB_MAX_LANES	16
+
+int sha256_mb_init(void);
+int sha256_mb_lanes(void);
+const char *sha256_mb_kernel(void);
+void sha256_mb(const unsigned char *const *, size_t, int, unsigned char (*)[SHA256_MB_DIGEST_SIZE]);
+int sha256_mb_self_test(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined SHA256_MB_H */
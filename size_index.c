@@ -0,0 +1,181 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "size_index.h"
+
+#define slot_hash(t, size) (((uint64_t)(size) * 0x9e3779b97f4a7c15ull) >> (t)->shift)
+
+static int
+table_alloc(struct size_table *t, uint64_t nr_slots)
+{
+	int		shift = 64;
+	uint64_t	n;
+
+	if (!(t->slots = calloc(nr_slots, sizeof(struct size_slot))))
+		return -1;
+
+	for (n = nr_slots; n > 1; n >>= 1)
+		--shift;
+
+	t->nr_slots = nr_slots;
+	t->nr_used = 0;
+	t->shift = shift;
+
+	return 0;
+}
+
+/*
+ * The slot holding SIZE in T, or the free slot where it would go.
+ */
+static struct size_slot *
+table_find(struct size_table *t, uint64_t size)
+{
+	uint64_t	mask = t->nr_slots - 1;
+	uint64_t	i = slot_hash(t, size);
+
+	while (t->slots[i].group && t->slots[i].size != size)
+		i = ((i + 1) & mask);
+
+	return &t->slots[i];
+}
+
+/*
+ * Move up to NR slots' worth of entries from the old table into the
+ * current one. The old table is left as it is (a lookup in it must
+ * still be able to probe past the slots already moved) and freed once
+ * it has been gone through.
+ */
+static void
+migrate(struct size_index *si, uint64_t nr)
+{
+	struct size_slot	*s, *d;
+
+	while (si->old.slots && nr--)
+	{
+		s = &si->old.slots[si->migrated];
+
+		if (s->group)
+		{
+			d = table_find(&si->cur, s->size);
+			*d = *s;
+			++si->cur.nr_used;
+		}
+
+		if (++si->migrated == si->old.nr_slots)
+		{
+			free(si->old.slots);
+			memset(&si->old, 0, sizeof(si->old));
+			si->migrated = 0;
+		}
+	}
+}
+
+int
+size_index_init(struct size_index *si)
+{
+	memset(si, 0, sizeof(*si));
+	return table_alloc(&si->cur, SIZE_INDEX_INITIAL);
+}
+
+/*
+ * Free the tables; the groups are the caller's to free.
+ */
+void
+size_index_free(struct size_index *si)
+{
+	free(si->cur.slots);
+	free(si->old.slots);
+	memset(si, 0, sizeof(*si));
+}
+
+/*
+ * Find the group of files of SIZE bytes. Returns a pointer to where the
+ * index keeps the group, which the caller sets if it is NULL (a new size,
+ * only added with CREATE set). The pointer is good until the next call.
+ * Returns NULL if the size is not there (and CREATE is not set) or the
+ * table could not grow.
+ */
+void **
+size_index_get(struct size_index *si, uint64_t size, int create)
+{
+	struct size_slot	*s;
+
+	if (create)
+		migrate(si, SIZE_INDEX_MIGRATE);
+
+	s = table_find(&si->cur, size);
+
+	if (s->group)
+		return &s->group;
+
+	if (si->old.slots)
+	{
+		struct size_slot	*o = table_find(&si->old, size);
+
+		/* slots before MIGRATED are in CUR already */
+		if (o->group)
+			return &o->group;
+	}
+
+	if (!create)
+		return NULL;
+
+	if ((si->cur.nr_used + 1) > ((si->cur.nr_slots >> 2) * 3))
+	{
+		/* should not happen: the old table is long gone by now */
+		if (si->old.slots)
+			migrate(si, si->old.nr_slots);
+
+		si->old = si->cur;
+
+		if (table_alloc(&si->cur, si->old.nr_slots << 1) < 0)
+		{
+			si->cur = si->old;
+			memset(&si->old, 0, sizeof(si->old));
+			return NULL;
+		}
+
+		si->migrated = 0;
+	}
+
+	s = table_find(&si->cur, size);
+	s->size = size;
+	++si->cur.nr_used;
+	++si->nr_groups;
+
+	return &s->group;
+}
+
+/*
+ * Walk the groups: start with *POS at 0 and call until NULL comes back.
+ * Nothing may be added in the meantime.
+ */
+void *
+size_index_next(struct size_index *si, uint64_t *pos)
+{
+	struct size_slot	*s;
+
+	while (*pos < si->cur.nr_slots)
+	{
+		s = &si->cur.slots[(*pos)++];
+
+		if (s->group)
+			return s->group;
+	}
+
+	while (si->old.slots && (*pos - si->cur.nr_slots) < si->old.nr_slots)
+	{
+		if ((*pos - si->cur.nr_slots) < si->migrated)
+		{
+			*pos = (si->cur.nr_slots + si->migrated);
+			continue;
+		}
+
+		s = &si->old.slots[(*pos)++ - si->cur.nr_slots];
+
+		if (s->group)
+			return s->group;
+	}
+
+	return NULL;
+}
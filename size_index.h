@@ -0,0 +1,59 @@
+#ifndef SIZE_INDEX_H
+#define SIZE_INDEX_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Index of the groups of same-sized files, keyed by the size.
+ *
+ * An open-addressing hash table with linear probing: a slot is just the
+ * size and a pointer to the group (which the front-end owns), so probing
+ * walks through a few adjacent cache lines at most. Directories often list
+ * files in order of size, which turned the binary tree this replaces into
+ * a list; a hash of the size does not care about the order.
+ *
+ * When the table is 3/4 full, a table twice the size is made and the
+ * entries are moved over a few at a time by each later insertion, so no
+ * insertion ever stops to rehash millions of entries; until they have all
+ * moved, lookups check both tables.
+ */
+
+#define SIZE_INDEX_INITIAL	1024
+#define SIZE_INDEX_MIGRATE	16 /* old slots moved per insertion */
+
+struct size_slot
+{
+	uint64_t	size;
+	void		*group;	/* NULL if the slot is free */
+};
+
+struct size_table
+{
+	struct size_slot	*slots;
+	uint64_t		nr_slots;
+	uint64_t		nr_used;
+	int			shift;	/* 64 - log2(nr_slots) */
+};
+
+struct size_index
+{
+	struct size_table	cur;
+	struct size_table	old;	/* being moved into CUR */
+	uint64_t		migrated; /* slots of OLD moved so far */
+	uint64_t		nr_groups;
+};
+
+int size_index_init(struct size_index *);
+void size_index_free(struct size_index *);
+void **size_index_get(struct size_index *, uint64_t, int);
+void *size_index_next(struct size_index *, uint64_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined SIZE_INDEX_H */
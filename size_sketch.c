@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "size_sketch.h"
+
+/*
+ * The I-th counter of SIZE, by double hashing: two halves of one
+ * multiplicative hash, the step made odd so that it never
+ * comes back to the same counter.
+ */
+#define sketch_hash(size)	((uint64_t)(size) * 0x9e3779b97f4a7c15ull)
+#define sketch_cell(s, h, i)	((((h) >> 32) + (i) * (((h) & 0xffffffffull) | 1)) & (s)->mask)
+
+#define cell_get(s, c)	(((s)->words[(c) >> 5] >> (((c) & 31) << 1)) & 3)
+#define cell_inc(s, c)	((s)->words[(c) >> 5] += ((uint64_t)1 << (((c) & 31) << 1)))
+
+/*
+ * A sketch sized for NR_FILES files (0 if not known).
+ */
+int
+size_sketch_init(struct size_sketch *s, uint64_t nr_files)
+{
+	uint64_t	want = (nr_files ? nr_files * SIZE_SKETCH_CELLS : SIZE_SKETCH_DEFAULT);
+	uint64_t	n = SIZE_SKETCH_MIN;
+
+	memset(s, 0, sizeof(*s));
+
+	while (n < want && n < SIZE_SKETCH_MAX)
+		n <<= 1;
+
+	if (!(s->words = calloc(n >> 5, sizeof(uint64_t))))
+		return -1;
+
+	s->nr_cells = n;
+	s->mask = n - 1;
+
+	return 0;
+}
+
+void
+size_sketch_free(struct size_sketch *s)
+{
+	free(s->words);
+	memset(s, 0, sizeof(*s));
+}
+
+void
+size_sketch_add(struct size_sketch *s, uint64_t size)
+{
+	uint64_t	h = sketch_hash(size);
+	uint64_t	c;
+	int		i;
+
+	for (i = 0; i < SIZE_SKETCH_K; ++i)
+	{
+		c = sketch_cell(s, h, (uint64_t)i);
+
+		if (cell_get(s, c) < 2)
+			cell_inc(s, c);
+	}
+
+	++s->nr_added;
+}
+
+/*
+ * How many times SIZE was added: 0, 1, or 2 for two or more.
+ */
+int
+size_sketch_count(struct size_sketch *s, uint64_t size)
+{
+	uint64_t	h = sketch_hash(size);
+	int		i, n, min = 2;
+
+	for (i = 0; i < SIZE_SKETCH_K; ++i)
+	{
+		if ((n = (int)cell_get(s, sketch_cell(s, h, (uint64_t)i))) < min)
+			min = n;
+	}
+
+	return min;
+}
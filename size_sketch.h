@@ -0,0 +1,47 @@
+#ifndef SIZE_SKETCH_H
+#define SIZE_SKETCH_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sketch of how often each file size occurs: a counting Bloom filter of
+ * 2-bit saturating counters (0, 1, 2 or more), SIZE_SKETCH_K of them per
+ * size. The count of a size is the smallest of its counters, so it can
+ * be too high (when other sizes share all of its counters) but never too
+ * low: a size said to be unique is unique.
+ *
+ * It takes a fixed amount of memory, chosen up front from the number of
+ * files expected (a byte per file, within limits), however many distinct
+ * sizes there turn out to be.
+ */
+
+#define SIZE_SKETCH_K		3
+#define SIZE_SKETCH_CELLS	4	/* counters per file expected */
+#define SIZE_SKETCH_MIN		((uint64_t)1 << 20)
+#define SIZE_SKETCH_MAX		((uint64_t)1 << 34)
+#define SIZE_SKETCH_DEFAULT	((uint64_t)1 << 24) /* if nothing is expected */
+
+struct size_sketch
+{
+	uint64_t	*words;	/* 32 counters to a word */
+	uint64_t	nr_cells;
+	uint64_t	mask;
+	uint64_t	nr_added;
+};
+
+int size_sketch_init(struct size_sketch *, uint64_t);
+void size_sketch_free(struct size_sketch *);
+void size_sketch_add(struct size_sketch *, uint64_t);
+int size_sketch_count(struct size_sketch *, uint64_t);
+
+#define size_sketch_bytes(s)	((s)->nr_cells >> 2)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined SIZE_SKETCH_H */
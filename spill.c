@@ -0,0 +1,485 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spill.h"
+
+/*
+ * A file of our own in DIR, unlinked at once so that nothing
+ * is left behind however the scan ends.
+ */
+static int
+spill_tmpfile(const char *dir)
+{
+	char		name[4096];
+	int		fd;
+
+	if (snprintf(name, sizeof(name), "%s/.pollux-spill-XXXXXX", dir) >= (int)sizeof(name))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if ((fd = mkstemp(name)) < 0)
+		return -1;
+
+	unlink(name);
+
+	return fd;
+}
+
+static int
+write_all(int fd, const void *buf, size_t n)
+{
+	const char	*p = buf;
+	ssize_t		w;
+
+	while (n)
+	{
+		if ((w = write(fd, p, n)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		p += w;
+		n -= (size_t)w;
+	}
+
+	return 0;
+}
+
+static int
+pread_all(int fd, void *buf, size_t n, uint64_t off)
+{
+	char		*p = buf;
+	ssize_t		r;
+
+	while (n)
+	{
+		if ((r = pread(fd, p, n, (off_t)off)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (r == 0)
+		{
+			errno = EIO;
+			return -1;
+		}
+
+		p += r;
+		n -= (size_t)r;
+		off += (uint64_t)r;
+	}
+
+	return 0;
+}
+
+/*
+ * By size, then by where the path is in the path file, which
+ * is the order the files were found in.
+ */
+static inline int
+rec_lt(const struct spill_rec *a, const struct spill_rec *b)
+{
+	if (a->size != b->size)
+		return a->size < b->size;
+
+	return spill_path_off(a) < spill_path_off(b);
+}
+
+static int
+rec_cmp(const void *a, const void *b)
+{
+	if (rec_lt(a, b))
+		return -1;
+
+	return (rec_lt(b, a) ? 1 : 0);
+}
+
+static int
+add_run(struct spill *s, int fd, uint64_t nr)
+{
+	void		*p;
+
+	if (s->nr_runs == s->max_runs)
+	{
+		s->max_runs = (s->max_runs ? (s->max_runs << 1) : SPILL_FANIN);
+
+		if (!(p = realloc(s->runs, s->max_runs * sizeof(struct spill_run))))
+			return -1;
+
+		s->runs = p;
+	}
+
+	memset(&s->runs[s->nr_runs], 0, sizeof(struct spill_run));
+	s->runs[s->nr_runs].fd = fd;
+	s->runs[s->nr_runs].nr = nr;
+	++s->nr_runs;
+
+	return 0;
+}
+
+static int
+flush_paths(struct spill *s)
+{
+	if (s->pbuf_len && write_all(s->path_fd, s->pbuf, s->pbuf_len) < 0)
+		return -1;
+
+	s->pbuf_len = 0;
+
+	return 0;
+}
+
+/*
+ * Sort the records collected so far and write them out as a run.
+ */
+static int
+write_run(struct spill *s)
+{
+	int		fd;
+
+	if (!s->nr_recs)
+		return 0;
+
+	qsort(s->recs, s->nr_recs, sizeof(struct spill_rec), rec_cmp);
+
+	if ((fd = spill_tmpfile(s->dir)) < 0)
+		return -1;
+
+	if (write_all(fd, s->recs, s->nr_recs * sizeof(struct spill_rec)) < 0 || add_run(s, fd, s->nr_recs) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	s->nr_spilled += s->nr_recs;
+	++s->nr_written;
+	s->nr_recs = 0;
+
+	return 0;
+}
+
+/*
+ * Read the next records of run R into its buffer. Returns
+ * how many were read (0 once the run is used up) or -1.
+ */
+static int64_t
+run_fill(struct spill *s, struct spill_run *r)
+{
+	uint64_t	n = r->nr - r->read;
+
+	if (n > s->max_recs)
+		n = s->max_recs;
+
+	if (n && pread_all(r->fd, r->buf, n * sizeof(struct spill_rec), r->read * sizeof(struct spill_rec)) < 0)
+		return -1;
+
+	r->read += n;
+	r->buf_nr = (uint32_t)n;
+	r->buf_pos = 0;
+
+	return (int64_t)n;
+}
+
+#define run_head(s, i) (&(s)->runs[(s)->heap[(i)]].buf[(s)->runs[(s)->heap[(i)]].buf_pos])
+
+static void
+heap_down(struct spill *s, uint32_t i)
+{
+	uint32_t	c, t;
+
+	while ((c = (i << 1) + 1) < s->heap_nr)
+	{
+		if ((c + 1) < s->heap_nr && rec_lt(run_head(s, c + 1), run_head(s, c)))
+			++c;
+
+		if (!rec_lt(run_head(s, c), run_head(s, i)))
+			break;
+
+		t = s->heap[i];
+		s->heap[i] = s->heap[c];
+		s->heap[c] = t;
+		i = c;
+	}
+}
+
+/*
+ * Get ready to merge the first NR runs, with a read buffer for each
+ * of them and one to write to, in half the memory allowed.
+ */
+static int
+heap_start(struct spill *s, uint32_t nr)
+{
+	uint32_t	i;
+	int64_t		n;
+
+	s->max_recs = (s->memory >> 1) / ((uint64_t)(nr + 1) * sizeof(struct spill_rec));
+	if (!s->max_recs)
+		s->max_recs = 1;
+
+	if (!(s->heap = realloc(s->heap, (nr + 1) * sizeof(uint32_t))))
+		return -1;
+
+	s->heap_nr = 0;
+
+	for (i = 0; i < nr; ++i)
+	{
+		if (!(s->runs[i].buf = malloc(s->max_recs * sizeof(struct spill_rec))))
+			return -1;
+
+		if ((n = run_fill(s, &s->runs[i])) < 0)
+			return -1;
+
+		if (n)
+			s->heap[s->heap_nr++] = i;
+	}
+
+	for (i = (s->heap_nr >> 1); i-- > 0;)
+		heap_down(s, i);
+
+	return 0;
+}
+
+/*
+ * The smallest record of the runs being merged, into REC.
+ * Returns 1, or 0 when they are all used up, or -1.
+ */
+static int
+heap_pop(struct spill *s, struct spill_rec *rec)
+{
+	struct spill_run	*r;
+	int64_t			n;
+
+	if (!s->heap_nr)
+		return 0;
+
+	r = &s->runs[s->heap[0]];
+	*rec = r->buf[r->buf_pos++];
+
+	if (r->buf_pos == r->buf_nr)
+	{
+		if ((n = run_fill(s, r)) < 0)
+			return -1;
+
+		if (!n)
+			s->heap[0] = s->heap[--s->heap_nr];
+	}
+
+	heap_down(s, 0);
+
+	return 1;
+}
+
+static void
+close_runs(struct spill *s, uint32_t nr)
+{
+	uint32_t	i;
+
+	for (i = 0; i < nr; ++i)
+	{
+		close(s->runs[i].fd);
+		free(s->runs[i].buf);
+	}
+
+	memmove(s->runs, s->runs + nr, (s->nr_runs - nr) * sizeof(struct spill_run));
+	s->nr_runs -= nr;
+}
+
+/*
+ * Merge the first NR runs into one at the end of the list.
+ */
+static int
+merge_pass(struct spill *s, uint32_t nr)
+{
+	struct spill_rec	rec;
+	uint64_t		total = 0, n = 0;
+	int			fd, r;
+
+	if (heap_start(s, nr) < 0)
+		return -1;
+
+	if (!(s->obuf = realloc(s->obuf, s->max_recs * sizeof(struct spill_rec))))
+		return -1;
+
+	if ((fd = spill_tmpfile(s->dir)) < 0)
+		return -1;
+
+	while ((r = heap_pop(s, &rec)) > 0)
+	{
+		s->obuf[n++] = rec;
+
+		if (n == s->max_recs)
+		{
+			if (write_all(fd, s->obuf, n * sizeof(struct spill_rec)) < 0)
+				goto fail;
+
+			total += n;
+			n = 0;
+		}
+	}
+
+	if (r < 0 || write_all(fd, s->obuf, n * sizeof(struct spill_rec)) < 0)
+		goto fail;
+
+	total += n;
+	close_runs(s, nr);
+
+	if (add_run(s, fd, total) < 0)
+		goto fail;
+
+	++s->nr_passes;
+
+	return 0;
+
+	fail:
+	close(fd);
+	return -1;
+}
+
+/*
+ * Spill to files in DIR, in about MEMORY bytes.
+ */
+int
+spill_init(struct spill *s, size_t memory, const char *dir)
+{
+	memset(s, 0, sizeof(*s));
+
+	s->path_fd = -1;
+	s->dir = dir;
+	s->memory = (memory < SPILL_MIN_MEMORY ? SPILL_MIN_MEMORY : memory);
+	s->max_recs = (s->memory >> 1) / sizeof(struct spill_rec);
+
+	if (!(s->recs = malloc(s->max_recs * sizeof(struct spill_rec))))
+		return -1;
+
+	if (!(s->pbuf = malloc(SPILL_PATH_BUF)))
+		return -1;
+
+	if ((s->path_fd = spill_tmpfile(dir)) < 0)
+		return -1;
+
+	return 0;
+}
+
+void
+spill_free(struct spill *s)
+{
+	if (!s->dir)
+		return;
+
+	if (s->runs)
+		close_runs(s, s->nr_runs);
+
+	if (s->path_fd >= 0)
+		close(s->path_fd);
+
+	free(s->runs);
+	free(s->heap);
+	free(s->obuf);
+	free(s->recs);
+	free(s->pbuf);
+
+	memset(s, 0, sizeof(*s));
+	s->path_fd = -1;
+}
+
+/*
+ * Add the file at PATH (LEN bytes long).
+ */
+int
+spill_add(struct spill *s, uint64_t size, const char *path, size_t len)
+{
+	struct spill_rec	*rec;
+
+	if (len >= ((size_t)1 << (64 - SPILL_LEN_SHIFT)))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (s->nr_recs == s->max_recs && write_run(s) < 0)
+		return -1;
+
+	if ((s->pbuf_len + len + 1) > SPILL_PATH_BUF && flush_paths(s) < 0)
+		return -1;
+
+	memcpy(s->pbuf + s->pbuf_len, path, len);
+	s->pbuf[s->pbuf_len + len] = 0;
+	s->pbuf_len += (len + 1);
+
+	rec = &s->recs[s->nr_recs++];
+	rec->size = size;
+	rec->path = (((uint64_t)len << SPILL_LEN_SHIFT) | s->path_len);
+
+	s->path_len += (len + 1);
+	++s->nr_files;
+
+	return 0;
+}
+
+/*
+ * The scan is over: write out the last run and merge the runs
+ * down to no more than SPILL_FANIN, ready for spill_next().
+ */
+int
+spill_finish(struct spill *s)
+{
+	if (flush_paths(s) < 0 || write_run(s) < 0)
+		return -1;
+
+	free(s->recs);
+	s->recs = NULL;
+	free(s->pbuf);
+	s->pbuf = NULL;
+
+	while (s->nr_runs > SPILL_FANIN)
+	{
+		if (merge_pass(s, SPILL_FANIN) < 0)
+			return -1;
+	}
+
+	free(s->obuf);
+	s->obuf = NULL;
+
+	return heap_start(s, s->nr_runs);
+}
+
+/*
+ * The next record in order of size, into REC. Returns 1,
+ * or 0 once there are no more, or -1.
+ */
+int
+spill_next(struct spill *s, struct spill_rec *rec)
+{
+	return heap_pop(s, rec);
+}
+
+/*
+ * The path of the file of REC, into BUF (of SIZE bytes).
+ */
+int
+spill_path(struct spill *s, const struct spill_rec *rec, char *buf, size_t size)
+{
+	size_t		len = spill_path_len(rec);
+
+	if ((len + 1) > size)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (pread_all(s->path_fd, buf, len, spill_path_off(rec)) < 0)
+		return -1;
+
+	buf[len] = 0;
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef SPILL_H
+#define SPILL_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * External sort of the files found by the scan, for scans whose index
+ * would not fit in memory.
+ *
+ * Each file is a 16-byte record: its size and where its path is in a
+ * file of paths. Records are collected in a buffer of at most half the
+ * memory allowed; when it is full, it is sorted by size and written out
+ * as a run. Once the scan is over, the runs are merged
+ * (SPILL_FANIN at a time, over as many passes as it takes), and the
+ * records come back one at a time in order of size, files of one size
+ * in the order they were found. All the files are unlinked as soon as
+ * they are made.
+ */
+
+#define SPILL_FANIN	64	/* runs merged at once */
+#define SPILL_MIN_MEMORY	((size_t)4 * 1024 * 1024)
+#define SPILL_PATH_BUF	(256 * 1024)	/* write buffer of the path file */
+
+/*
+ * The path of a file is at offset (PATH & SPILL_OFF_MASK) in the path
+ * file, and is (PATH >> SPILL_LEN_SHIFT) bytes long (without the NUL).
+ */
+#define SPILL_LEN_SHIFT	48
+#define SPILL_OFF_MASK	(((uint64_t)1 << SPILL_LEN_SHIFT) - 1)
+#define spill_path_off(r)	((r)->path & SPILL_OFF_MASK)
+#define spill_path_len(r)	((size_t)((r)->path >> SPILL_LEN_SHIFT))
+
+struct spill_rec
+{
+	uint64_t	size;
+	uint64_t	path;
+};
+
+struct spill_run
+{
+	int			fd;
+	uint64_t		nr;	/* records in the run */
+	uint64_t		read;	/* records read into BUF so far */
+	struct spill_rec	*buf;
+	uint32_t		buf_nr;
+	uint32_t		buf_pos;
+};
+
+struct spill
+{
+	const char		*dir;
+	size_t			memory;
+	struct spill_rec	*recs;
+	uint64_t		nr_recs;
+	uint64_t		max_recs;	/* of RECS, then of each run's BUF */
+	int			path_fd;
+	uint64_t		path_len;	/* bytes written to the path file */
+	char			*pbuf;
+	size_t			pbuf_len;
+	struct spill_run	*runs;
+	uint32_t		nr_runs;
+	uint32_t		max_runs;
+	uint32_t		*heap;	/* of indices into RUNS */
+	uint32_t		heap_nr;
+	struct spill_rec	*obuf;	/* output buffer of a merge pass */
+	/* for the stats */
+	uint64_t		nr_files;
+	uint64_t		nr_spilled;	/* records written to runs */
+	uint32_t		nr_written;	/* runs written by the scan */
+	uint32_t		nr_passes;	/* merge passes before the last */
+};
+
+int spill_init(struct spill *, size_t, const char *);
+void spill_free(struct spill *);
+int spill_add(struct spill *, uint64_t, const char *, size_t);
+int spill_finish(struct spill *);
+int spill_next(struct spill *, struct spill_rec *);
+int spill_path(struct spill *, const struct spill_rec *, char *, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined SPILL_H */